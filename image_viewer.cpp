@@ -6,23 +6,123 @@
  * * Setup:
  * Ensure 'stb_image.h' is in the same directory or include path.
  * Download it here: https://github.com/nothings/stb/blob/master/stb_image.h
+ * Optional: build with -DFIV_USE_LIBJPEG and link -ljpeg (libjpeg-turbo) to add a JPEG decoder
+ * backend that decodes with a scaled IDCT at screen resolution instead of full resolution.
+ * Optional: build with -DFIV_USE_NVJPEG and link -lnvjpeg -lcudart to decode JPEGs on an
+ * NVIDIA GPU. It takes the decodes the scaled IDCT can't shrink, falling back to the CPU.
+ * * Usage:
+ *   image_viewer [options] <directory>
+ *   --cache-mb N    Memory budget for decoded pixels in MB (default 2048).
+ *   --prefetch N    Images kept decoded ahead of the current one, fewer on slow storage (default 8).
+ *   --texture-ring K  Neighbours on each side kept uploaded to the GPU (default 2).
+ *   --filter F      Downscaling filter, lanczos (default) or box.
+ *   --recursive     Also review images in subdirectories.
+ *   --no-preview-cache  Don't read or write screen sized previews in ~/.cache/fastimageviewer.
+ *   --disk-cache-mb N  Disk budget for those previews in MB (default 4096). The least recently used
+ *                   go first, previews of changed or deleted files are dropped at startup.
+ *   --no-scan-cache Always list every directory instead of reusing the cached scan.
+ *   --bench         Step through every image without input, then print per stage latencies.
+ *   --huge-pages    Back large pixel buffers with transparent huge pages.
+ *   --no-pin        Let the OS place decode threads instead of pinning one to each core.
+ *   --packed-mb N   Memory budget in MB for evicted images kept losslessly packed (default 512, 0 disables).
+ *   --rgba          Keep screen sized decodes as RGBA instead of planar YUV 4:2:0 (no packed tier).
+ *   --trace FILE    Write a Chrome trace (chrome://tracing, Perfetto) of the session on exit.
+ *   --headless      Don't open a window: decode every image into the preview cache, hash included, and
+ *                   bring the journal up to date, so the viewer opened on the folder later starts warm.
+ *   --export DIR    Copy the images marked good to DIR and exit without a window, after the work
+ *                   of --headless if it is given too.
+ *   --size WxH      Screen size headless previews are made for (default 2560x1440).
+ *   --follow        Jump to each new image as it lands in a reviewed directory (tethered shooting).
+ *                   New files are picked up either way, on Linux.
+ * * Keys: arrows / a / d / space navigate (held down, they scrub through thumbnails),
+ *   up / down mark, page up / down rotate, z / = / - / mouse wheel zoom, drag or i / j / k / l pan,
+ *   g steps between bursts instead of images, h toggles the performance overlay.
+ *   c switches to a contact sheet: arrows move (shift selects), page up / down scroll,
+ *   b marks the selection bad, n resets it to neutral, c or return go back to the image.
  */
 
 #include <iostream>
 #include <vector>
 #include <string>
 #include <filesystem>
-#include <future>
 #include <algorithm>
 #include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <queue>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <climits>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <array>
+#include <memory>
+#include <cctype>
+#include <bitset>
+#include <deque>
+#include <string_view>
 
 // SDL2
 #include <SDL2/SDL.h>
 
-// STB Image Implementation
+// STB Image Implementation, allocating from the pixel buffer pool
+void* pixelAlloc(size_t size);
+void* pixelRealloc(void* block, size_t size);
+void pixelFree(void* block);
+#define STBI_MALLOC(size) pixelAlloc(size)
+#define STBI_REALLOC(block, size) pixelRealloc(block, size)
+#define STBI_FREE(block) pixelFree(block)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+// SIMD kernels for the orientation transforms
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Memory mapped preview cache
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <process.h>
+#endif
+
+// Decode thread placement
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Directory watching
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#ifdef FIV_USE_LIBJPEG
+#include <csetjmp>
+#include <jpeglib.h>
+#endif
+
+#ifdef FIV_USE_NVJPEG
+#include <cuda_runtime_api.h>
+#include <nvjpeg.h>
+#endif
+
 namespace fs = std::filesystem;
 
 // ---------------------------------------------------------
@@ -35,226 +135,4681 @@ enum class ImageStatus {
     Bad
 };
 
-struct RawImage {
-    std::string filename;
-    std::string fullPath; // Full path for symlinking
+// Owning handle to a buffer from the pixel buffer pool
+struct PixelDeleter {
+    void operator()(unsigned char* block) const { pixelFree(block); }
+};
+using PixelBuffer = std::unique_ptr<unsigned char, PixelDeleter>;
+// Pixels held by the decode cache. The uploads keep a reference across the GPU copy, so they
+// don't need the cache lock while a loader replaces or evicts the image.
+using SharedPixels = std::shared_ptr<unsigned char>;
+
+struct MipLevel {
+    SharedPixels data;
     int width;
     int height;
-    int channels;
-    unsigned char* data; // Raw pixel data in RAM
-    bool loaded;
-    ImageStatus status = ImageStatus::Neutral;
+};
+
+// Memory layout of RawImage::data
+enum class PixelLayout {
+    Rgba, // 4 bytes per pixel
+    I420  // Planar YUV 4:2:0: the Y plane, then U and V at half width and height (SDL_PIXELFORMAT_IYUV)
+};
+
+// Decoded pixels of one image. Only images around the current one hold an entry,
+// the catalogue points at it through cacheSlot.
+struct RawImage {
+    size_t owner = SIZE_MAX; // Catalogue index of the image, SIZE_MAX while the entry is free
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    SharedPixels data; // Raw pixel data in RAM (owned by the decode cache)
+    PixelLayout layout = PixelLayout::Rgba; // Of data, the mips and thumbnail are always RGBA
+    int fullWidth = 0;  // Dimensions of the source image before any scaled decode
+    int fullHeight = 0;
+    bool fullRes = false; // data is the full resolution decode, otherwise it is screen sized
+    std::vector<MipLevel> mips; // Successive halvings of a full resolution decode, for zoom levels
+    SharedPixels thumbData; // Embedded EXIF thumbnail, shown until data is ready
+    int thumbWidth = 0;
+    int thumbHeight = 0;
+};
+
+// A scanned directory, as a slice of the catalogue arena
+struct CatalogueDir {
+    uint32_t path = 0;           // Full path including the trailing separator
+    uint32_t pathLength = 0;
+    uint32_t relativeLength = 0; // Tail of the path relative to the root, without the separator
+};
+
+const uint32_t kNoSlot = UINT32_MAX;
+
+// Every image found, as parallel arrays so scans over the set only touch the bytes
+// they need. A path is a directory plus a file name, both stored once in the arena.
+struct Catalogue {
+    std::string arena;
+    std::vector<CatalogueDir> dirs;
+    std::vector<uint32_t> dir;        // Per image: directory, and file name offset and length in the arena
+    std::vector<uint32_t> name;
+    std::vector<uint16_t> nameLength;
+
+    std::vector<ImageStatus> status;
+    std::vector<uint8_t> orientation; // EXIF orientation (1-8) applied at render time, 0 until the file is parsed
+    std::vector<uint8_t> loaded;
+    std::vector<uint8_t> loading;     // A decode is in flight
+    std::vector<uint8_t> failed;      // Decoding failed, don't retry
+    std::vector<uint8_t> wantFullRes; // Zoomed in, decode at full resolution
+    std::vector<unsigned> generation; // Bumped whenever the decoded pixels or thumbnail are replaced
+    std::vector<uint32_t> cacheSlot;  // Entry in g_decoded, kNoSlot when nothing is resident
+    std::vector<uint64_t> hash;       // Perceptual hash of the first decode, once hashed is set
+    std::vector<float> sharpness;
+    std::vector<uint8_t> hashed;
+    std::vector<uint8_t> sameAsPrevious; // Near duplicate of the image before it, so in the same burst
+    std::vector<uint8_t> thumbChecked;   // The file was read for its EXIF thumbnail while scrubbing
+
+    size_t size() const { return dir.size(); }
 };
 
 // ---------------------------------------------------------
 // Global State
 // ---------------------------------------------------------
 
-std::vector<RawImage> g_images;
+Catalogue g_catalogue;
+std::deque<RawImage> g_decoded;     // Entries never move, freed ones are listed for reuse
+std::vector<uint32_t> g_freeDecoded;
 size_t g_currentIndex = 0;
-SDL_Texture* g_displayTexture = nullptr;
-int g_texWidth = 0;
-int g_texHeight = 0;
+float g_zoomScale = 0.0f; // Screen pixels per source pixel, 0 fits the image to the window
+bool g_groupMode = false; // Navigation steps between bursts of near duplicates, showing the sharpest of each
+bool g_scrubbing = false; // A navigation key is auto-repeating: show thumbnails, hold off on decodes
+
+// Contact sheet: a page of thumbnails with g_currentIndex as the cursor
+bool g_gridMode = false;
+size_t g_gridFirst = 0;           // First image on the page, always the start of a row
+size_t g_gridAnchor = SIZE_MAX;   // Other end of the selection from the cursor, SIZE_MAX for just the cursor
+const int kGridColumns = 10;
+const int kGridRows = 8;
+const size_t kGridPage = (size_t)kGridColumns * kGridRows;
+const int kScrubSettleMs = 150; // Without a repeat for this long, scrubbing ends
+const int kScrubLookahead = 4;  // Thumbnails read ahead while scrubbing
+fs::path g_rootDir;   // The reviewed directory, absolute
 fs::path g_chosenDir; // Path to the "chosen" subdirectory
 
-// ---------------------------------------------------------
-// Helper Functions
-// ---------------------------------------------------------
+// Decode cache: only a window of images around the current one is kept decoded.
+// g_decoded and the catalogue state touched by the loaders are guarded by g_cacheMutex.
+size_t g_cacheBudgetBytes = (size_t)2048 * 1024 * 1024; // --cache-mb
+size_t g_cacheBytes = 0;    // Decoded bytes currently resident
+size_t g_cacheLoaded = 0;   // Number of images currently resident
+size_t g_navCount = 0;      // Navigations so far, and how many found their image resident
+size_t g_navHits = 0;
+int g_prefetchAhead = 8;    // Window size in the direction of travel (--prefetch)
+int g_prefetchBehind = 2;   // Window size against the direction of travel
+int g_navDirection = 1;     // +1 when moving forward, -1 when moving backward
+size_t g_cacheCenter = 0;   // Snapshot of g_currentIndex the loaders evict around
+int g_cacheDirection = 1;   // Snapshot of g_navDirection the loaders evict around
+size_t g_cacheGridFirst = SIZE_MAX; // Snapshot of g_gridFirst while the contact sheet is up
+std::mutex g_cacheMutex;
+std::condition_variable g_cacheCv; // Signalled whenever a decode finishes
+
+// Packed tier below the decode cache: planar screen sized decodes evicted from it are packed
+// losslessly by a background thread and kept under their own budget, so coming back to one
+// costs an unpack instead of a read, decode and resample. Guarded by g_cacheMutex.
+struct PackedImage {
+    std::vector<uint8_t> bytes; // packI420 output
+    int width = 0;              // I420 size
+    int height = 0;
+    int fullWidth = 0;
+    int fullHeight = 0;
+};
+
+std::unordered_map<size_t, std::shared_ptr<const PackedImage>> g_packed; // By catalogue index
+size_t g_packedBudgetBytes = (size_t)512 * 1024 * 1024; // --packed-mb
+size_t g_packedBytes = 0;
+unsigned g_catalogueEpoch = 0; // Bumped whenever images are inserted and indexes shift, guarded by g_cacheMutex
+
+struct PendingPack {
+    size_t index;
+    unsigned epoch; // g_catalogueEpoch when queued, the index is stale once it moved on
+    SharedPixels planes;
+    int width, height, fullWidth, fullHeight;
+};
+
+struct Packer {
+    std::thread thread;
+    std::deque<PendingPack> pending; // Oldest first
+    std::mutex mutex; // Guards pending and stopping
+    std::condition_variable cv;
+    bool stopping = false;
+};
+
+Packer g_packer;
+const size_t kMaxPendingPacks = 16; // Beyond this the oldest evictions are dropped unpacked
+
+// The main loop sleeps in SDL_WaitEventTimeout until input or this event, which the
+// loaders post when new pixels land. At most one is queued at a time.
+Uint32 g_wakeEvent = (Uint32)-1;
+std::atomic<bool> g_wakePosted{false};
+const int kIdleWaitMs = 500;
+const int kHoldPollMs = 10; // While new files wait for the decode pool to drain
+const int kUploadPollMs = 4; // Between batches of neighbour uploads, input and new pixels wake it sooner
+
+// Size decodes are scaled to, tracks the renderer output size
+std::atomic<int> g_targetWidth{1280};
+std::atomic<int> g_targetHeight{720};
+
+// GPU texture ring: the current image and its neighbours stay uploaded, so navigating
+// only swaps which texture is drawn. Neighbours are uploaded a band of rows per frame.
+struct TextureSlot {
+    SDL_Texture* texture = nullptr;
+    size_t index = SIZE_MAX;  // Image held, SIZE_MAX if the slot is free
+    unsigned generation = 0;  // Catalogue::generation of the pixels being uploaded
+    int width = 0;            // Texture size
+    int height = 0;
+    int fullWidth = 0;        // Full resolution size of the image
+    int fullHeight = 0;
+    int level = 0;            // Mip level uploaded, 0 is RawImage::data
+    int rowsUploaded = 0;     // Progress of the banded upload, complete at height
+    bool preview = false;     // Holds the EXIF thumbnail rather than the decode
+    Uint32 format = SDL_PIXELFORMAT_RGBA32; // Texture format, IYUV for planar decodes
+};
+
+std::vector<TextureSlot> g_textureSlots;
+
+// Zoomed in, the current image is drawn from fixed size tiles of a mip level instead, so images
+// larger than the maximum texture size work and only the visible part is uploaded
+struct Tile {
+    SDL_Texture* texture = nullptr;
+    size_t index = SIZE_MAX; // Image, Catalogue::generation and mip level the tile was cut from
+    unsigned generation = 0;
+    int level = 0;
+    int col = 0;             // Position in tiles
+    int row = 0;
+    uint64_t lastUsed = 0;   // g_tileFrame it was last drawn in
+};
+
+const int kTileSize = 512;
+const size_t kMaxTiles = 96;         // 96 MB of tile textures
+const int kTileUploadsPerFrame = 8;
+std::vector<Tile> g_tiles;
+uint64_t g_tileFrame = 0;
+float g_panX = 0.0f; // View center relative to the image center, in full resolution pixels
+float g_panY = 0.0f; // and stored orientation
+
+// The contact sheet draws its thumbnails from a few large atlas textures cut into fixed cells,
+// so a whole page is one geometry batch per atlas instead of a texture per image
+struct AtlasCell {
+    size_t index = SIZE_MAX; // Image held, SIZE_MAX if the cell is free
+    unsigned generation = 0; // Catalogue::generation of the uploaded pixels
+    int width = 0;           // Part of the cell in use, stored orientation
+    int height = 0;
+    uint64_t lastUsed = 0;   // g_atlasFrame it was last on screen in
+};
+
+struct Atlas {
+    SDL_Texture* texture = nullptr;
+    std::vector<AtlasCell> cells; // Row major, kAtlasSize / kAtlasCell per row
+};
+
+const int kAtlasSize = 2048;
+const int kAtlasCell = 256;
+const int kAtlasCount = 3;            // 192 cells, the page on screen and most of the next one
+const int kAtlasUploadsPerFrame = 16;
+std::vector<Atlas> g_atlases;
+uint64_t g_atlasFrame = 0;
+
+int g_textureRingRadius = 2; // --texture-ring
+const size_t kUploadBytesPerFrame = (size_t)16 * 1024 * 1024; // Neighbour upload budget per frame
+
+// Persistent cache directory for previews and scan indexes, empty when unavailable
+fs::path g_diskCacheDir;
+bool g_usePreviewCache = true; // --no-preview-cache
+bool g_useScanCache = true;    // --no-scan-cache
+uint64_t g_diskCacheBudgetBytes = (uint64_t)4096 * 1024 * 1024; // --disk-cache-mb
+
+// Keeps the previews within their budget on a background thread, see Preview Cache Budget
+struct CacheSweeper {
+    std::thread thread;
+    std::atomic<uint64_t> previewBytes{ 0 }; // On disk as of the last sweep, plus what was written since
+    std::mutex mutex; // Guards requested and stopping
+    std::condition_variable cv;
+    bool requested = false;
+    bool stopping = false;
+};
+
+CacheSweeper g_cacheSweeper;
+
+// Decode thread pool fed by a priority queue, lowest cacheDistance first
+enum class DecodeKind {
+    Image,            // Screen sized or full resolution decode
+    Thumbnail,        // Just the EXIF thumbnail, while scrubbing
+    ThumbnailOrImage  // The EXIF thumbnail, a screen sized decode for files without one (contact sheet)
+};
+
+struct DecodeJob {
+    size_t index;
+    size_t priority;
+    DecodeKind kind = DecodeKind::Image;
+    bool operator<(const DecodeJob& other) const { return priority > other.priority; }
+};
+
+// A core a decode worker runs on, see CPU Topology
+struct DecodeCpu {
+    int cpu = -1;            // Logical CPU the worker is pinned to, -1 when unpinned
+    bool efficiency = false; // Slower core of a hybrid CPU, gets the speculative prefetch
+};
+
+struct DecodePool {
+    std::vector<std::thread> workers;
+    std::priority_queue<DecodeJob> queue;
+    std::mutex mutex; // Guards queue, the idle counts and stopping. Never taken before g_cacheMutex.
+    std::condition_variable cv;
+    unsigned idlePerformance = 0; // Workers waiting for a job, by core type
+    unsigned idleEfficiency = 0;
+    bool stopping = false;
+};
+
+DecodePool g_decodePool;
+bool g_pinDecodes = true; // --no-pin turns it off
+
+// Storage throttling: source reads for the prefetch go through a gate sized from the measured
+// bandwidth, so the current image never queues behind more than kReadLatencyTarget of them.
+// The current image's own read skips the gate.
+struct ReadGate {
+    std::mutex mutex; // Guards everything below. Never taken before g_cacheMutex.
+    std::condition_variable cv;
+    int inFlight = 0;
+    int limit = INT_MAX;      // Concurrent prefetch reads allowed, unlimited until measured
+    double bandwidth = 0;     // Bytes per second across all reads, moving average
+    double fileBytes = 0;     // Size of a source file, moving average
+    double decodeSeconds = 0; // Decode and resample time of one image, moving average
+};
+
+ReadGate g_readGate;
+const double kReadLatencyTarget = 0.1; // Seconds of prefetch reads the current image may wait behind
+const double kPrefetchHorizon = 2.0;   // Seconds of reading and decoding the prefetch queues up
+const double kThroughputWeight = 0.2;  // Weight of a new sample in the moving averages
+
+// Review status persistence, symlinks are created and removed on a background thread
+struct StatusChange {
+    std::string target; // Image the link points at
+    ImageStatus status;
+};
+
+// One review decision in the journal, see Review Journal
+struct JournalRecord {
+    uint64_t fileId;     // journalFileId of the image
+    uint8_t status;      // ImageStatus
+    uint8_t orientation; // Including the user's rotations, 0 while the EXIF tag hasn't been read
+    uint16_t reserved;
+    uint32_t check;      // Low half of hashBytes over the fields above, catches torn writes
+};
+static_assert(sizeof(JournalRecord) == 16, "journal records are written as is");
+
+struct StatusWriter {
+    std::thread thread;
+    std::unordered_map<std::string, StatusChange> pending; // Latest change per link name
+    std::vector<JournalRecord> journal; // Records to append, in order
+    std::mutex mutex; // Guards pending, journal and stopping
+    std::condition_variable cv;
+    bool stopping = false;
+};
+
+StatusWriter g_statusWriter;
+const std::chrono::milliseconds kStatusBatchDelay(50);
+FILE* g_journal = nullptr; // Open for appending, only touched by the status writer once it runs
+
+// Files that appear in the reviewed directories are reported by a background thread and
+// inserted by the main loop once the decode pool has gone idle, see Directory Watch
+struct WatchArrival {
+    std::string relative; // Directory relative to the root, "" for the root itself
+    std::string name;
+};
+
+struct DirectoryWatcher {
+    std::thread thread;
+    int fd = -1;
+    std::unordered_map<int, std::string> dirs; // Watch descriptor to relative directory, the watch thread's once it runs
+    std::unordered_set<std::string> watched;   // Relative directories in dirs
+    bool recursive = false;                    // Subdirectories are watched too, new ones included
+    std::vector<WatchArrival> arrived;          // In arrival order
+    std::mutex mutex; // Guards arrived and stopping
+    bool stopping = false;
+};
+
+DirectoryWatcher g_watcher;
+bool g_followNewest = false; // --follow
+bool g_holdDecodes = false;  // Arrivals wait for the pool to drain, no new jobs are queued meanwhile. Main thread only.
+
+// ---------------------------------------------------------
+// Helper Functions
+// ---------------------------------------------------------
+
+bool isImageFile(const fs::path& path) {
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return (ext == ".jpg" || ext == ".jpeg" || ext == ".png" || ext == ".bmp" || ext == ".tga");
+}
+
+// Fits a width x height image into the window, preserving aspect ratio
+SDL_Rect fitToWindow(int width, int height, int winW, int winH) {
+    float imgAspect = (float)width / (float)height;
+    float winAspect = (float)winW / (float)winH;
+
+    SDL_Rect dstRect;
+    
+    if (winAspect > imgAspect) {
+        dstRect.h = winH;
+        dstRect.w = (int)(winH * imgAspect);
+        dstRect.y = 0;
+        dstRect.x = (winW - dstRect.w) / 2;
+    } else {
+        dstRect.w = winW;
+        dstRect.h = (int)(winW / imgAspect);
+        dstRect.x = 0;
+        dstRect.y = (winH - dstRect.h) / 2;
+    }
+    return dstRect;
+}
+
+// ---------------------------------------------------------
+// CPU Topology
+// ---------------------------------------------------------
+
+// Decode workers are pinned one per core. On a multi-socket machine they and the main thread
+// stay on the NUMA node the viewer started on: pages land on the node of the thread that first
+// writes them, so decodes there stay local to the thread uploading them. On a hybrid CPU the
+// current image goes to the performance cores and prefetch to the efficiency cores.
+
+// Expands a sysfs CPU list like "0-3,8,10-11"
+std::vector<int> parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    const char* p = list.c_str();
+    while (*p) {
+        char* end;
+        long first = std::strtol(p, &end, 10);
+        if (end == p) break;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = std::strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) cpus.push_back((int)cpu);
+        if (*p == ',') ++p;
+    }
+    return cpus;
+}
+
+// First line of a sysfs file, empty if it doesn't exist
+std::string readSysfsLine(const std::string& path) {
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+#ifdef __linux__
+// CPUs of the NUMA node the given CPU belongs to, empty on single node machines
+std::vector<int> nodeCpus(int cpu) {
+    std::error_code ec;
+    std::vector<int> found;
+    unsigned nodes = 0;
+    for (const auto& entry : fs::directory_iterator("/sys/devices/system/node", ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.compare(0, 4, "node") != 0 || name.size() == 4 || !isdigit((unsigned char)name[4])) continue;
+        nodes++;
+        std::vector<int> cpus = parseCpuList(readSysfsLine((entry.path() / "cpulist").string()));
+        if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) found = cpus;
+    }
+    if (nodes < 2) found.clear();
+    return found;
+}
+#endif
+
+// The cores to run decode workers on, empty to leave placement to the OS. Cores of a hybrid CPU
+// are told apart by cpu_capacity (ARM) or else their maximum clock (Intel): a core clearly
+// slower than the fastest one counts as an efficiency core.
+std::vector<DecodeCpu> decodeCpus() {
+    std::vector<DecodeCpu> cpus;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return cpus;
+
+    // Keep the main thread on its node, the workers join it there
+    int self = sched_getcpu();
+    std::vector<int> node = self >= 0 ? nodeCpus(self) : std::vector<int>();
+    if (!node.empty()) {
+        cpu_set_t local;
+        CPU_ZERO(&local);
+        for (int cpu : node) {
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) CPU_SET(cpu, &local);
+        }
+        if (CPU_COUNT(&local) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(local), &local) == 0) allowed = local;
+    }
+
+    std::vector<long> speeds;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        std::string speed = readSysfsLine(base + "/cpu_capacity");
+        if (speed.empty()) speed = readSysfsLine(base + "/cpufreq/cpuinfo_max_freq");
+        cpus.push_back({ cpu, false });
+        speeds.push_back(std::atol(speed.c_str()));
+    }
+    long fastest = speeds.empty() ? 0 : *std::max_element(speeds.begin(), speeds.end());
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        cpus[i].efficiency = speeds[i] > 0 && speeds[i] < fastest * 4 / 5;
+    }
+#endif
+    return cpus;
+}
+
+void pinThread(const DecodeCpu& cpu) {
+#ifdef __linux__
+    if (cpu.cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu.cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+}
+
+// ---------------------------------------------------------
+// Pixel Buffer Pool
+// ---------------------------------------------------------
+
+// Decodes, resamples and mips allocate and free buffers of a few sizes over and over as
+// the cache window slides. Large blocks are rounded up to a size class and kept on a free
+// list when released, so the next image of the same size reuses the block (and its
+// already faulted-in pages) instead of a fresh mmap. Every block carries a header so any
+// pointer handed out, stb's small internal allocations included, can be freed here.
+struct PoolHeader {
+    size_t capacity; // Size class of a pooled block, 0 for small malloc'd blocks
+    size_t size;     // Bytes requested
+    size_t pad[6];   // Keeps the payload of mapped blocks 64 byte aligned, small ones get malloc's alignment
+};
+
+struct PixelPool {
+    std::mutex mutex;
+    std::unordered_map<size_t, std::vector<PoolHeader*>> freeBlocks; // By capacity
+    size_t freeBytes = 0; // Bytes sitting in freeBlocks
+    size_t allocations = 0; // Pooled allocations, and how many reused a free block
+    size_t reused = 0;
+};
+
+const size_t kPoolMinBytes = (size_t)1 << 20;           // Smaller requests go straight to malloc
+const size_t kPoolRetainBytes = (size_t)256 * 1024 * 1024; // Free blocks kept beyond this are released
+bool g_hugePages = false; // --huge-pages
+bool g_planarDecodes = true; // Screen sized decodes are stored as I420, --rgba turns it off
+
+// The pool is never destroyed: pixel buffers held by other statics, the decode cache and the
+// packed tier, may still be freed into it while the program exits
+PixelPool& pixelPool() {
+    static PixelPool* pool = new PixelPool();
+    return *pool;
+}
+
+// Rounds up to a quarter power of two step, wasting at most 25%
+size_t poolSizeClass(size_t size) {
+    size_t step = (size_t)1 << 62;
+    while (step > size) step >>= 1;
+    step = std::max<size_t>(step >> 2, 4096);
+    return (size + step - 1) / step * step;
+}
+
+PoolHeader* mapBlock(size_t capacity) {
+#ifdef _WIN32
+    return (PoolHeader*)malloc(sizeof(PoolHeader) + capacity);
+#else
+    void* block = mmap(nullptr, sizeof(PoolHeader) + capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED) return nullptr;
+#ifdef MADV_HUGEPAGE
+    if (g_hugePages) madvise(block, sizeof(PoolHeader) + capacity, MADV_HUGEPAGE);
+#endif
+    return (PoolHeader*)block;
+#endif
+}
+
+void unmapBlock(PoolHeader* header) {
+#ifdef _WIN32
+    free(header);
+#else
+    munmap(header, sizeof(PoolHeader) + header->capacity);
+#endif
+}
+
+void* pixelAlloc(size_t size) {
+    PoolHeader* header;
+    if (size < kPoolMinBytes) {
+        header = (PoolHeader*)malloc(sizeof(PoolHeader) + size);
+        if (!header) return nullptr;
+        header->capacity = 0;
+        header->size = size;
+        return header + 1;
+    }
+
+    size_t capacity = poolSizeClass(size);
+    PixelPool& pool = pixelPool();
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.allocations++;
+        auto it = pool.freeBlocks.find(capacity);
+        if (it != pool.freeBlocks.end() && !it->second.empty()) {
+            header = it->second.back();
+            it->second.pop_back();
+            pool.freeBytes -= capacity;
+            pool.reused++;
+            header->size = size;
+            return header + 1;
+        }
+    }
+    header = mapBlock(capacity);
+    if (!header) return nullptr;
+    header->capacity = capacity;
+    header->size = size;
+    return header + 1;
+}
+
+void pixelFree(void* block) {
+    if (!block) return;
+    PoolHeader* header = (PoolHeader*)block - 1;
+    if (!header->capacity) {
+        free(header);
+        return;
+    }
+    PixelPool& pool = pixelPool();
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (pool.freeBytes + header->capacity <= kPoolRetainBytes) {
+            pool.freeBlocks[header->capacity].push_back(header);
+            pool.freeBytes += header->capacity;
+            return;
+        }
+    }
+    unmapBlock(header);
+}
+
+void* pixelRealloc(void* block, size_t size) {
+    if (!block) return pixelAlloc(size);
+    PoolHeader* header = (PoolHeader*)block - 1;
+    if (!header->capacity && size < kPoolMinBytes) {
+        header = (PoolHeader*)realloc(header, sizeof(PoolHeader) + size);
+        if (!header) return nullptr;
+        header->size = size;
+        return header + 1;
+    }
+    if (header->capacity >= size) {
+        header->size = size;
+        return block;
+    }
+
+    void* moved = pixelAlloc(size);
+    if (!moved) return nullptr;
+    memcpy(moved, block, std::min(header->size, size));
+    pixelFree(block);
+    return moved;
+}
+
+PixelBuffer allocPixels(size_t size) {
+    return PixelBuffer((unsigned char*)pixelAlloc(size));
+}
+
+// ---------------------------------------------------------
+// Instrumentation
+// ---------------------------------------------------------
+
+using TraceClock = std::chrono::steady_clock;
+
+// One timed span. Names must be string literals, only the pointer is stored.
+struct TraceEvent {
+    const char* name;
+    int64_t start;    // Nanoseconds on TraceClock
+    int64_t duration;
+};
+
+// Each thread writes its own ring, so recording takes no lock. The oldest events
+// are overwritten once it wraps. Rings are only read after their thread stopped.
+struct TraceRing {
+    std::string threadName;
+    uint32_t threadId = 0;
+    std::vector<TraceEvent> events;
+    uint64_t written = 0;
+};
+
+const size_t kTraceRingSize = 16384; // Events kept per thread
+std::mutex g_traceMutex; // Guards g_traceRings, taken once per thread
+std::vector<std::unique_ptr<TraceRing>> g_traceRings;
+std::string g_traceOutput; // --trace
+
+TraceRing& traceRing() {
+    thread_local TraceRing* ring = nullptr;
+    if (!ring) {
+        std::lock_guard<std::mutex> lock(g_traceMutex);
+        g_traceRings.push_back(std::make_unique<TraceRing>());
+        ring = g_traceRings.back().get();
+        ring->threadId = (uint32_t)g_traceRings.size();
+        ring->threadName = "thread " + std::to_string(ring->threadId);
+        ring->events.resize(kTraceRingSize);
+    }
+    return *ring;
+}
+
+void setTraceThreadName(const std::string& name) {
+    traceRing().threadName = name;
+}
+
+int64_t traceNanos(TraceClock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+void traceRecord(const char* name, TraceClock::time_point start, TraceClock::time_point end) {
+    TraceRing& ring = traceRing();
+    ring.events[ring.written++ % kTraceRingSize] = { name, traceNanos(start), traceNanos(end) - traceNanos(start) };
+}
+
+// Times the enclosing scope
+struct TraceScope {
+    const char* name;
+    TraceClock::time_point start;
+    explicit TraceScope(const char* name) : name(name), start(TraceClock::now()) {}
+    ~TraceScope() { traceRecord(name, start, TraceClock::now()); }
+};
+
+// Writes every ring as Chrome trace events. Call once all other threads have stopped.
+void writeTrace(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "Failed to write trace: %s\n", path.c_str());
+        return;
+    }
+    std::lock_guard<std::mutex> lock(g_traceMutex);
+    int64_t epoch = INT64_MAX;
+    for (const auto& ring : g_traceRings) {
+        uint64_t count = std::min<uint64_t>(ring->written, kTraceRingSize);
+        for (uint64_t i = ring->written - count; i < ring->written; ++i) epoch = std::min(epoch, ring->events[i % kTraceRingSize].start);
+    }
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    bool first = true;
+    for (const auto& ring : g_traceRings) {
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", ring->threadId, ring->threadName.c_str());
+        first = false;
+        uint64_t count = std::min<uint64_t>(ring->written, kTraceRingSize);
+        for (uint64_t i = ring->written - count; i < ring->written; ++i) {
+            const TraceEvent& event = ring->events[i % kTraceRingSize];
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    event.name, ring->threadId, (event.start - epoch) / 1000.0, event.duration / 1000.0);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    std::cout << "Trace written to " << path << std::endl;
+}
+
+// 3x5 bitmap font for the overlay, one bit per pixel, rows top to bottom
+struct Glyph {
+    char c;
+    uint16_t bits;
+};
+
+const Glyph kHudFont[] = {
+    { '0', 0b111'101'101'101'111 }, { '1', 0b010'110'010'010'111 }, { '2', 0b111'001'111'100'111 },
+    { '3', 0b111'001'111'001'111 }, { '4', 0b101'101'111'001'001 }, { '5', 0b111'100'111'001'111 },
+    { '6', 0b111'100'111'101'111 }, { '7', 0b111'001'001'001'001 }, { '8', 0b111'101'111'101'111 },
+    { '9', 0b111'101'111'001'111 }, { 'A', 0b010'101'111'101'101 }, { 'B', 0b110'101'110'101'110 },
+    { 'C', 0b011'100'100'100'011 }, { 'D', 0b110'101'101'101'110 }, { 'E', 0b111'100'110'100'111 },
+    { 'F', 0b111'100'110'100'100 }, { 'G', 0b011'100'101'101'011 }, { 'H', 0b101'101'111'101'101 },
+    { 'I', 0b111'010'010'010'111 }, { 'J', 0b001'001'001'101'010 }, { 'K', 0b101'101'110'101'101 },
+    { 'L', 0b100'100'100'100'111 }, { 'M', 0b101'111'111'101'101 }, { 'N', 0b110'101'101'101'101 },
+    { 'O', 0b010'101'101'101'010 }, { 'P', 0b110'101'110'100'100 }, { 'Q', 0b010'101'101'110'011 },
+    { 'R', 0b110'101'110'101'101 }, { 'S', 0b011'100'010'001'110 }, { 'T', 0b111'010'010'010'010 },
+    { 'U', 0b101'101'101'101'111 }, { 'V', 0b101'101'101'101'010 }, { 'W', 0b101'101'111'111'101 },
+    { 'X', 0b101'101'010'101'101 }, { 'Y', 0b101'101'010'010'010 }, { 'Z', 0b111'001'010'100'111 },
+    { '.', 0b000'000'000'000'010 }, { ':', 0b000'010'000'010'000 }, { '%', 0b101'001'010'100'101 },
+    { '/', 0b001'001'010'100'100 }, { '-', 0b000'000'111'000'000 }, { '(', 0b010'100'100'100'010 },
+    { ')', 0b010'001'001'001'010 },
+};
+
+uint16_t glyphBits(char c) {
+    c = (char)toupper((unsigned char)c);
+    for (const Glyph& glyph : kHudFont) {
+        if (glyph.c == c) return glyph.bits;
+    }
+    return 0; // Space and anything unknown
+}
+
+// Draws lines of text in the top left corner over a translucent backdrop
+void drawHud(SDL_Renderer* renderer, const std::vector<std::string>& lines) {
+    const int scale = 3, advance = 4 * scale, lineHeight = 7 * scale, margin = 8;
+    size_t longest = 0;
+    for (const auto& line : lines) longest = std::max(longest, line.size());
+
+    SDL_Rect backdrop = { margin, margin, (int)longest * advance + 2 * scale, (int)lines.size() * lineHeight + scale };
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 170);
+    SDL_RenderFillRect(renderer, &backdrop);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+
+    std::vector<SDL_Rect> pixels;
+    for (size_t row = 0; row < lines.size(); ++row) {
+        for (size_t col = 0; col < lines[row].size(); ++col) {
+            uint16_t bits = glyphBits(lines[row][col]);
+            for (int y = 0; y < 5; ++y) {
+                for (int x = 0; x < 3; ++x) {
+                    if (!(bits & (1 << (14 - y * 3 - x)))) continue;
+                    pixels.push_back({ margin + 2 * scale + (int)col * advance + x * scale,
+                                       margin + 2 * scale + (int)row * lineHeight + y * scale, scale, scale });
+                }
+            }
+        }
+    }
+    SDL_SetRenderDrawColor(renderer, 230, 230, 230, 255);
+    SDL_RenderFillRects(renderer, pixels.data(), (int)pixels.size());
+}
+
+// ---------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------
+
+// Pipeline stages timed in --bench mode. Rotation has no stage of its own,
+// orientation is applied by the renderer and is part of Present.
+enum class BenchStage {
+    Read,     // File read
+    Preview,  // Cached preview load
+    Decode,   // JPEG or EXIF thumbnail decode
+    Resample, // Shrink to the fitted size
+    Mips,     // Mip chain of a full resolution decode
+    Hash,     // Perceptual hash and sharpness of the decode
+    Planar,   // Conversion of a screen sized decode to YUV 4:2:0
+    Pack,     // Packing an evicted decode for the packed tier
+    Unpack,   // Restoring a decode from the packed tier
+    Upload,   // One SDL_UpdateTexture call
+    Present,  // Navigation to the first present showing the decoded image
+    Count
+};
+
+const char* kBenchStageNames[] = { "read", "preview", "decode", "resample", "mips", "hash", "yuv", "pack", "unpack", "upload", "present" };
+
+struct BenchStats {
+    std::mutex mutex;
+    std::array<std::vector<double>, (size_t)BenchStage::Count> samples; // Milliseconds
+    size_t images = 0;       // Decodes published
+    double megapixels = 0.0; // Source megapixels of those decodes
+    std::vector<std::pair<const char*, size_t>> decoders; // Decodes per backend
+};
+
+bool g_benchMode = false; // --bench, set before any thread starts
+const std::chrono::seconds kBenchStepTimeout(10); // An image not shown by then counts as failed
+bool g_headless = false;  // --headless or --export, set before any thread starts
+BenchStats g_bench;
+
+// Traces the time since start as a stage, and records it for the --bench report
+void recordStage(BenchStage stage, TraceClock::time_point start) {
+    TraceClock::time_point end = TraceClock::now();
+    traceRecord(kBenchStageNames[(size_t)stage], start, end);
+    if (!g_benchMode) return;
+    std::chrono::duration<double, std::milli> elapsed = end - start;
+    std::lock_guard<std::mutex> lock(g_bench.mutex);
+    g_bench.samples[(size_t)stage].push_back(elapsed.count());
+}
+
+void recordDecoded(int fullWidth, int fullHeight) {
+    if (!g_benchMode) return;
+    std::lock_guard<std::mutex> lock(g_bench.mutex);
+    g_bench.images++;
+    g_bench.megapixels += (double)fullWidth * fullHeight / 1e6;
+}
+
+void recordDecoder(const char* backend) {
+    if (!g_benchMode) return;
+    std::lock_guard<std::mutex> lock(g_bench.mutex);
+    for (auto& entry : g_bench.decoders) {
+        if (entry.first == backend) {
+            entry.second++;
+            return;
+        }
+    }
+    g_bench.decoders.push_back({ backend, 1 });
+}
+
+// Nearest-rank percentile of sorted samples
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+// Peak resident set size in MB, 0 where unsupported
+double peakRssMB() {
+#ifdef _WIN32
+    return 0.0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0.0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0); // Bytes
+#else
+    return usage.ru_maxrss / 1024.0; // Kilobytes
+#endif
+#endif
+}
+
+// Current resident set size in MB from /proc/self/statm, 0 where unsupported
+double currentRssMB() {
+#ifdef __linux__
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) return 0.0;
+    unsigned long long size = 0, resident = 0;
+    int fields = fscanf(f, "%llu %llu", &size, &resident);
+    fclose(f);
+    return fields == 2 ? resident * (double)sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0) : 0.0;
+#else
+    return 0.0;
+#endif
+}
+
+void printBenchReport(double seconds, size_t shown, size_t failed) {
+    std::lock_guard<std::mutex> lock(g_bench.mutex);
+    printf("Benchmark: %zu images shown in %.2f s", shown, seconds);
+    if (failed) printf(", %zu failed or timed out", failed);
+    printf("\n");
+    printf("%-10s %8s %10s %10s %10s\n", "stage", "count", "p50 ms", "p95 ms", "p99 ms");
+    for (size_t i = 0; i < (size_t)BenchStage::Count; ++i) {
+        std::vector<double>& samples = g_bench.samples[i];
+        if (samples.empty()) continue;
+        std::sort(samples.begin(), samples.end());
+        printf("%-10s %8zu %10.2f %10.2f %10.2f\n", kBenchStageNames[i], samples.size(),
+               percentile(samples, 50), percentile(samples, 95), percentile(samples, 99));
+    }
+    printf("Decoder:");
+    for (const auto& [backend, decodes] : g_bench.decoders) printf(" %s (%zu)", backend, decodes);
+    printf("%s\n", g_bench.decoders.empty() ? " none, everything came from previews or thumbnails" : "");
+    printf("Throughput: %.1f images/s, %.1f MP/s decoded\n", g_bench.images / seconds, g_bench.megapixels / seconds);
+    printf("Peak RSS: %.0f MB\n", peakRssMB());
+    {
+        PixelPool& pool = pixelPool();
+        std::lock_guard<std::mutex> poolLock(pool.mutex);
+        printf("Pixel pool: %zu large allocations, %.0f%% reused, %zu MB held free\n", pool.allocations,
+               pool.allocations ? 100.0 * pool.reused / pool.allocations : 0.0, pool.freeBytes >> 20);
+    }
+    fflush(stdout);
+}
+
+// ---------------------------------------------------------
+// Orientation Kernels
+// ---------------------------------------------------------
+
+// Where a source pixel goes for each EXIF orientation. Flips are in destination space,
+// swapAxes means the destination is height wide and width tall.
+struct OrientMapping {
+    bool swapAxes;
+    bool flipX;
+    bool flipY;
+};
+
+OrientMapping orientationMapping(int orientation) {
+    switch (orientation) {
+        case 2: return { false, true, false }; // Mirror horizontal
+        case 3: return { false, true, true };  // Rotate 180
+        case 4: return { false, false, true }; // Mirror vertical
+        case 5: return { true, false, false }; // Transpose
+        case 6: return { true, true, false };  // Rotate 90 CW
+        case 7: return { true, true, true };   // Transverse
+        case 8: return { true, false, true };  // Rotate 90 CCW
+        default: return { false, false, false };
+    }
+}
+
+// Copies a row of pixels, optionally reversing their order
+void copyPixelRow(const uint32_t* src, uint32_t* dst, int count, bool reverse) {
+    if (!reverse) {
+        memcpy(dst, src, (size_t)count * 4);
+        return;
+    }
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256i reversed = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + count - 8 - i), _mm256_permutevar8x32_epi32(v, reversed));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + count - 4 - i), _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= count; i += 4) {
+        uint32x4_t v = vrev64q_u32(vld1q_u32(src + i));
+        vst1q_u32(dst + count - 4 - i, vextq_u32(v, v, 2));
+    }
+#endif
+    for (; i < count; ++i) dst[count - 1 - i] = src[i];
+}
+
+// Transposes a kTransposeBlock square of pixels. Source column i is written as a
+// contiguous run starting at dstRuns[i], reversed if reverse is set.
+#if defined(__AVX2__)
+const int kTransposeBlock = 8;
+
+void transposeBlock(const uint32_t* src, size_t stride, uint32_t* const* dstRuns, bool reverse) {
+    __m256i r0 = _mm256_loadu_si256((const __m256i*)(src + 0 * stride));
+    __m256i r1 = _mm256_loadu_si256((const __m256i*)(src + 1 * stride));
+    __m256i r2 = _mm256_loadu_si256((const __m256i*)(src + 2 * stride));
+    __m256i r3 = _mm256_loadu_si256((const __m256i*)(src + 3 * stride));
+    __m256i r4 = _mm256_loadu_si256((const __m256i*)(src + 4 * stride));
+    __m256i r5 = _mm256_loadu_si256((const __m256i*)(src + 5 * stride));
+    __m256i r6 = _mm256_loadu_si256((const __m256i*)(src + 6 * stride));
+    __m256i r7 = _mm256_loadu_si256((const __m256i*)(src + 7 * stride));
+
+    __m256i t0 = _mm256_unpacklo_epi32(r0, r1), t1 = _mm256_unpackhi_epi32(r0, r1);
+    __m256i t2 = _mm256_unpacklo_epi32(r2, r3), t3 = _mm256_unpackhi_epi32(r2, r3);
+    __m256i t4 = _mm256_unpacklo_epi32(r4, r5), t5 = _mm256_unpackhi_epi32(r4, r5);
+    __m256i t6 = _mm256_unpacklo_epi32(r6, r7), t7 = _mm256_unpackhi_epi32(r6, r7);
+
+    __m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+    __m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+    __m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6);
+    __m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+
+    __m256i columns[8] = {
+        _mm256_permute2x128_si256(u0, u4, 0x20), _mm256_permute2x128_si256(u1, u5, 0x20),
+        _mm256_permute2x128_si256(u2, u6, 0x20), _mm256_permute2x128_si256(u3, u7, 0x20),
+        _mm256_permute2x128_si256(u0, u4, 0x31), _mm256_permute2x128_si256(u1, u5, 0x31),
+        _mm256_permute2x128_si256(u2, u6, 0x31), _mm256_permute2x128_si256(u3, u7, 0x31),
+    };
+    const __m256i reversed = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    for (int i = 0; i < 8; ++i) {
+        __m256i c = reverse ? _mm256_permutevar8x32_epi32(columns[i], reversed) : columns[i];
+        _mm256_storeu_si256((__m256i*)dstRuns[i], c);
+    }
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+const int kTransposeBlock = 4;
+
+void transposeBlock(const uint32_t* src, size_t stride, uint32_t* const* dstRuns, bool reverse) {
+    __m128i r0 = _mm_loadu_si128((const __m128i*)(src + 0 * stride));
+    __m128i r1 = _mm_loadu_si128((const __m128i*)(src + 1 * stride));
+    __m128i r2 = _mm_loadu_si128((const __m128i*)(src + 2 * stride));
+    __m128i r3 = _mm_loadu_si128((const __m128i*)(src + 3 * stride));
+
+    __m128i t0 = _mm_unpacklo_epi32(r0, r1), t1 = _mm_unpacklo_epi32(r2, r3);
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1), t3 = _mm_unpackhi_epi32(r2, r3);
+
+    __m128i columns[4] = {
+        _mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1),
+        _mm_unpacklo_epi64(t2, t3), _mm_unpackhi_epi64(t2, t3),
+    };
+    for (int i = 0; i < 4; ++i) {
+        __m128i c = reverse ? _mm_shuffle_epi32(columns[i], _MM_SHUFFLE(0, 1, 2, 3)) : columns[i];
+        _mm_storeu_si128((__m128i*)dstRuns[i], c);
+    }
+}
+#elif defined(__ARM_NEON)
+const int kTransposeBlock = 4;
+
+void transposeBlock(const uint32_t* src, size_t stride, uint32_t* const* dstRuns, bool reverse) {
+    uint32x4x2_t p01 = vtrnq_u32(vld1q_u32(src + 0 * stride), vld1q_u32(src + 1 * stride));
+    uint32x4x2_t p23 = vtrnq_u32(vld1q_u32(src + 2 * stride), vld1q_u32(src + 3 * stride));
+
+    uint32x4_t columns[4] = {
+        vcombine_u32(vget_low_u32(p01.val[0]), vget_low_u32(p23.val[0])),
+        vcombine_u32(vget_low_u32(p01.val[1]), vget_low_u32(p23.val[1])),
+        vcombine_u32(vget_high_u32(p01.val[0]), vget_high_u32(p23.val[0])),
+        vcombine_u32(vget_high_u32(p01.val[1]), vget_high_u32(p23.val[1])),
+    };
+    for (int i = 0; i < 4; ++i) {
+        uint32x4_t c = columns[i];
+        if (reverse) {
+            c = vrev64q_u32(c);
+            c = vextq_u32(c, c, 2);
+        }
+        vst1q_u32(dstRuns[i], c);
+    }
+}
+#else
+const int kTransposeBlock = 4;
+
+void transposeBlock(const uint32_t* src, size_t stride, uint32_t* const* dstRuns, bool reverse) {
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            dstRuns[i][reverse ? 3 - j : j] = src[j * stride + i];
+        }
+    }
+}
+#endif
+
+// Tile edge for the cache-blocked transpose, 64x64 RGBA is 16 KB on each side
+const int kOrientTile = 64;
+
+// Applies an EXIF orientation, moving whole 32-bit pixels. Axis-swapping orientations
+// walk the source in tiles so both reads and writes stay within cache.
+void orientPixels(const uint32_t* src, int width, int height, int orientation, uint32_t* dst) {
+    OrientMapping m = orientationMapping(orientation);
+
+    if (!m.swapAxes) {
+        for (int y = 0; y < height; ++y) {
+            int dy = m.flipY ? height - 1 - y : y;
+            copyPixelRow(src + (size_t)y * width, dst + (size_t)dy * width, width, m.flipX);
+        }
+        return;
+    }
+
+    // Destination address of source pixel (x, y)
+    auto dstAt = [&](int x, int y) -> uint32_t* {
+        int dx = m.flipX ? height - 1 - y : y;
+        int dy = m.flipY ? width - 1 - x : x;
+        return dst + (size_t)dy * height + dx;
+    };
+
+    const int block = kTransposeBlock;
+    for (int ty = 0; ty < height; ty += kOrientTile) {
+        int tyEnd = std::min(ty + kOrientTile, height);
+        for (int tx = 0; tx < width; tx += kOrientTile) {
+            int txEnd = std::min(tx + kOrientTile, width);
+
+            // Column blocks outermost so consecutive blocks extend the same destination rows
+            int x = tx;
+            for (; x + block <= txEnd; x += block) {
+                int y = ty;
+                for (; y + block <= tyEnd; y += block) {
+                    // Flipped runs are written backwards, so they start at the last source row
+                    uint32_t* runs[8];
+                    for (int i = 0; i < block; ++i) runs[i] = dstAt(x + i, m.flipX ? y + block - 1 : y);
+                    transposeBlock(src + (size_t)y * width + x, width, runs, m.flipX);
+                }
+                for (; y < tyEnd; ++y) {
+                    for (int i = 0; i < block; ++i) *dstAt(x + i, y) = src[(size_t)y * width + x + i];
+                }
+            }
+            for (; x < txEnd; ++x) {
+                for (int y = ty; y < tyEnd; ++y) *dstAt(x, y) = src[(size_t)y * width + x];
+            }
+        }
+    }
+}
+
+/**
+ * Applies an EXIF orientation (1-8) to raw RGBA pixel data, returning a newly
+ * allocated buffer. Width and height are swapped for orientations 5-8.
+ * The viewer itself orients at render time, this is for when the pixels
+ * themselves have to be upright (e.g. exporting).
+ */
+PixelBuffer orientImage(const unsigned char* in_data, int width, int height, int orientation) {
+    PixelBuffer out_data = allocPixels((size_t)width * height * 4);
+    if (!out_data) return nullptr;
+    orientPixels((const uint32_t*)in_data, width, height, orientation, (uint32_t*)out_data.get());
+    return out_data;
+}
+
+// Orientations expressed as an optional horizontal mirror followed by clockwise
+// quarter turns, which is the order SDL_RenderCopyEx applies flip and angle in.
+struct DisplayTransform {
+    bool mirror;
+    int quarterTurns;
+};
+
+DisplayTransform orientationTransform(int orientation) {
+    static const DisplayTransform table[9] = {
+        { false, 0 }, { false, 0 }, { true, 0 }, { false, 2 }, { true, 2 },
+        { true, 3 }, { false, 1 }, { true, 1 }, { false, 3 },
+    };
+    return table[(orientation >= 1 && orientation <= 8) ? orientation : 1];
+}
+
+// Composes an orientation with extra clockwise quarter turns
+int rotateOrientation(int orientation, int quarterTurns) {
+    DisplayTransform t = orientationTransform(orientation);
+    int turns = ((t.quarterTurns + quarterTurns) % 4 + 4) % 4;
+    for (int o = 1; o <= 8; ++o) {
+        DisplayTransform candidate = orientationTransform(o);
+        if (candidate.mirror == t.mirror && candidate.quarterTurns == turns) return o;
+    }
+    return 1;
+}
+
+// ---------------------------------------------------------
+// Resampling
+// ---------------------------------------------------------
+
+enum class ResampleFilter {
+    Box,
+    Lanczos3
+};
+
+ResampleFilter g_resampleFilter = ResampleFilter::Lanczos3; // --filter
+
+// Filter weights are 2.14 fixed point so that two of them fit a 16-bit multiply-add
+const int kWeightBits = 14;
+
+// Per output position: the first source sample and its weights, padded to maxTaps
+struct FilterTaps {
+    std::vector<int> first;
+    std::vector<int> count;
+    std::vector<int16_t> weights;
+    int maxTaps = 0;
+};
+
+double filterSupport(ResampleFilter filter) {
+    return filter == ResampleFilter::Box ? 0.5 : 3.0;
+}
+
+double filterWeight(ResampleFilter filter, double x) {
+    if (filter == ResampleFilter::Box) return (x >= -0.5 && x < 0.5) ? 1.0 : 0.0;
+    const double pi = 3.14159265358979323846;
+    x = std::fabs(x);
+    if (x < 1e-8) return 1.0;
+    if (x >= 3.0) return 0.0;
+    double px = pi * x;
+    return 3.0 * std::sin(px) * std::sin(px / 3.0) / (px * px);
+}
+
+// Computes the taps for shrinking inSize samples to outSize. The filter is stretched by the
+// scale factor so every source sample contributes, which is what keeps minification alias free.
+FilterTaps computeFilterTaps(int inSize, int outSize, ResampleFilter filter) {
+    double scale = (double)inSize / outSize;
+    double filterScale = std::max(1.0, scale);
+    double support = filterSupport(filter) * filterScale;
+
+    FilterTaps taps;
+    taps.maxTaps = (int)std::ceil(support) * 2 + 1;
+    taps.first.resize(outSize);
+    taps.count.resize(outSize);
+    taps.weights.assign((size_t)outSize * taps.maxTaps, 0);
+
+    std::vector<double> w(taps.maxTaps);
+    for (int i = 0; i < outSize; ++i) {
+        double center = (i + 0.5) * scale;
+        int lo = std::max(0, (int)(center - support + 0.5));
+        int hi = std::min(inSize, (int)(center + support + 0.5));
+        int n = std::min(hi - lo, taps.maxTaps);
+
+        double total = 0.0;
+        for (int k = 0; k < n; ++k) {
+            w[k] = filterWeight(filter, (lo + k - center + 0.5) / filterScale);
+            total += w[k];
+        }
+        if (total == 0.0) {
+            // Degenerate window, fall back to the nearest sample
+            lo = std::min(inSize - 1, (int)center);
+            n = 1;
+            w[0] = total = 1.0;
+        }
+
+        // Quantize so each set of weights sums to exactly one, the rounding error goes to the peak
+        int16_t* q = &taps.weights[(size_t)i * taps.maxTaps];
+        int sum = 0, peak = 0;
+        for (int k = 0; k < n; ++k) {
+            q[k] = (int16_t)std::lround(w[k] / total * (1 << kWeightBits));
+            sum += q[k];
+            if (q[k] > q[peak]) peak = k;
+        }
+        q[peak] = (int16_t)(q[peak] + (1 << kWeightBits) - sum);
+        taps.first[i] = lo;
+        taps.count[i] = n;
+    }
+    return taps;
+}
+
+inline uint8_t clampToByte(int32_t v) {
+    v >>= kWeightBits;
+    return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+inline uint32_t loadPixel(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// Horizontal pass: filters each row of RGBA pixels down to dstWidth
+void resampleRows(const uint8_t* src, int srcWidth, int rows, uint8_t* dst, int dstWidth, const FilterTaps& taps) {
+    for (int y = 0; y < rows; ++y) {
+        const uint8_t* srcRow = src + (size_t)y * srcWidth * 4;
+        uint8_t* dstRow = dst + (size_t)y * dstWidth * 4;
+        for (int x = 0; x < dstWidth; ++x) {
+            const uint8_t* p = srcRow + (size_t)taps.first[x] * 4;
+            const int16_t* w = &taps.weights[(size_t)x * taps.maxTaps];
+            int n = taps.count[x];
+            int k = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+            // Two pixels per step: interleave them so one madd weighs both for all four channels
+            const __m128i zero = _mm_setzero_si128();
+            __m128i acc = _mm_set1_epi32(1 << (kWeightBits - 1));
+            for (; k + 2 <= n; k += 2) {
+                __m128i pair = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)loadPixel(p + k * 4)),
+                                                 _mm_cvtsi32_si128((int)loadPixel(p + k * 4 + 4)));
+                __m128i weights = _mm_set1_epi32((int)(uint16_t)w[k] | ((int)w[k + 1] << 16));
+                acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi8(pair, zero), weights));
+            }
+            if (k < n) {
+                __m128i single = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)loadPixel(p + k * 4)), zero);
+                __m128i weights = _mm_set1_epi32((int)(uint16_t)w[k]);
+                acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi8(single, zero), weights));
+            }
+            acc = _mm_srai_epi32(acc, kWeightBits);
+            acc = _mm_packs_epi32(acc, acc);
+            int out = _mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+            memcpy(dstRow + (size_t)x * 4, &out, 4);
+#elif defined(__ARM_NEON)
+            int32x4_t acc = vdupq_n_s32(1 << (kWeightBits - 1));
+            for (; k < n; ++k) {
+                uint8x8_t px = vreinterpret_u8_u32(vdup_n_u32(loadPixel(p + k * 4)));
+                int16x4_t wide = vget_low_s16(vreinterpretq_s16_u16(vmovl_u8(px)));
+                acc = vmlal_n_s16(acc, wide, w[k]);
+            }
+            uint16x4_t narrow = vqshrun_n_s32(acc, kWeightBits);
+            uint8x8_t bytes = vqmovn_u16(vcombine_u16(narrow, narrow));
+            vst1_lane_u32((uint32_t*)(dstRow + (size_t)x * 4), vreinterpret_u32_u8(bytes), 0);
+#else
+            int32_t acc[4] = { 1 << (kWeightBits - 1), 1 << (kWeightBits - 1), 1 << (kWeightBits - 1), 1 << (kWeightBits - 1) };
+            for (; k < n; ++k) {
+                for (int c = 0; c < 4; ++c) acc[c] += p[k * 4 + c] * w[k];
+            }
+            for (int c = 0; c < 4; ++c) dstRow[(size_t)x * 4 + c] = clampToByte(acc[c]);
+#endif
+        }
+    }
+}
+
+// Vertical pass: each output row is a weighted sum of source rows, vectorized across the row
+void resampleColumns(const uint8_t* src, size_t rowBytes, uint8_t* dst, int dstHeight, const FilterTaps& taps) {
+    for (int y = 0; y < dstHeight; ++y) {
+        const uint8_t* first = src + (size_t)taps.first[y] * rowBytes;
+        const int16_t* w = &taps.weights[(size_t)y * taps.maxTaps];
+        int n = taps.count[y];
+        uint8_t* dstRow = dst + (size_t)y * rowBytes;
+        size_t x = 0;
+
+#if defined(__AVX2__)
+        const __m256i zero256 = _mm256_setzero_si256();
+        for (; x + 32 <= rowBytes; x += 32) {
+            __m256i acc[4];
+            for (auto& a : acc) a = _mm256_set1_epi32(1 << (kWeightBits - 1));
+            for (int k = 0; k < n; k += 2) {
+                __m256i a = _mm256_loadu_si256((const __m256i*)(first + k * rowBytes + x));
+                __m256i b = (k + 1 < n) ? _mm256_loadu_si256((const __m256i*)(first + (k + 1) * rowBytes + x)) : zero256;
+                int16_t w1 = (k + 1 < n) ? w[k + 1] : 0;
+                __m256i weights = _mm256_set1_epi32((int)(uint16_t)w[k] | ((int)w1 << 16));
+                __m256i lo = _mm256_unpacklo_epi8(a, b), hi = _mm256_unpackhi_epi8(a, b);
+                acc[0] = _mm256_add_epi32(acc[0], _mm256_madd_epi16(_mm256_unpacklo_epi8(lo, zero256), weights));
+                acc[1] = _mm256_add_epi32(acc[1], _mm256_madd_epi16(_mm256_unpackhi_epi8(lo, zero256), weights));
+                acc[2] = _mm256_add_epi32(acc[2], _mm256_madd_epi16(_mm256_unpacklo_epi8(hi, zero256), weights));
+                acc[3] = _mm256_add_epi32(acc[3], _mm256_madd_epi16(_mm256_unpackhi_epi8(hi, zero256), weights));
+            }
+            // The unpacks and packs both work within 128-bit lanes, so the byte order round-trips
+            for (auto& a : acc) a = _mm256_srai_epi32(a, kWeightBits);
+            __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(acc[0], acc[1]), _mm256_packs_epi32(acc[2], acc[3]));
+            _mm256_storeu_si256((__m256i*)(dstRow + x), packed);
+        }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+        const __m128i zero = _mm_setzero_si128();
+        for (; x + 16 <= rowBytes; x += 16) {
+            __m128i acc[4];
+            for (auto& a : acc) a = _mm_set1_epi32(1 << (kWeightBits - 1));
+            for (int k = 0; k < n; k += 2) {
+                __m128i a = _mm_loadu_si128((const __m128i*)(first + k * rowBytes + x));
+                __m128i b = (k + 1 < n) ? _mm_loadu_si128((const __m128i*)(first + (k + 1) * rowBytes + x)) : zero;
+                int16_t w1 = (k + 1 < n) ? w[k + 1] : 0;
+                __m128i weights = _mm_set1_epi32((int)(uint16_t)w[k] | ((int)w1 << 16));
+                __m128i lo = _mm_unpacklo_epi8(a, b), hi = _mm_unpackhi_epi8(a, b);
+                acc[0] = _mm_add_epi32(acc[0], _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), weights));
+                acc[1] = _mm_add_epi32(acc[1], _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), weights));
+                acc[2] = _mm_add_epi32(acc[2], _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), weights));
+                acc[3] = _mm_add_epi32(acc[3], _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), weights));
+            }
+            for (auto& a : acc) a = _mm_srai_epi32(a, kWeightBits);
+            __m128i packed = _mm_packus_epi16(_mm_packs_epi32(acc[0], acc[1]), _mm_packs_epi32(acc[2], acc[3]));
+            _mm_storeu_si128((__m128i*)(dstRow + x), packed);
+        }
+#elif defined(__ARM_NEON)
+        for (; x + 8 <= rowBytes; x += 8) {
+            int32x4_t accLo = vdupq_n_s32(1 << (kWeightBits - 1));
+            int32x4_t accHi = accLo;
+            for (int k = 0; k < n; ++k) {
+                int16x8_t v = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(first + k * rowBytes + x)));
+                accLo = vmlal_n_s16(accLo, vget_low_s16(v), w[k]);
+                accHi = vmlal_n_s16(accHi, vget_high_s16(v), w[k]);
+            }
+            uint16x8_t narrow = vcombine_u16(vqshrun_n_s32(accLo, kWeightBits), vqshrun_n_s32(accHi, kWeightBits));
+            vst1_u8(dstRow + x, vqmovn_u16(narrow));
+        }
+#endif
+        for (; x < rowBytes; ++x) {
+            int32_t acc = 1 << (kWeightBits - 1);
+            for (int k = 0; k < n; ++k) acc += first[k * rowBytes + x] * w[k];
+            dstRow[x] = clampToByte(acc);
+        }
+    }
+}
+
+/**
+ * Shrinks raw RGBA pixel data to dstWidth x dstHeight with a separable filter,
+ * returning a newly allocated buffer.
+ */
+PixelBuffer resampleImage(const unsigned char* in_data, int width, int height, int dstWidth, int dstHeight, ResampleFilter filter) {
+    PixelBuffer rows = allocPixels((size_t)dstWidth * height * 4);
+    PixelBuffer out_data = allocPixels((size_t)dstWidth * dstHeight * 4);
+    if (!rows || !out_data) return nullptr;
+
+    FilterTaps horizontal = computeFilterTaps(width, dstWidth, filter);
+    FilterTaps vertical = computeFilterTaps(height, dstHeight, filter);
+    resampleRows(in_data, width, height, rows.get(), dstWidth, horizontal);
+    resampleColumns(rows.get(), (size_t)dstWidth * 4, out_data.get(), dstHeight, vertical);
+    return out_data;
+}
+
+/**
+ * Halves raw RGBA pixel data with a 2x2 box filter, the step between mip levels.
+ * Returns a newly allocated (width / 2) x (height / 2) buffer.
+ */
+PixelBuffer halveImage(const unsigned char* in_data, int width, int height) {
+    int outWidth = width / 2, outHeight = height / 2;
+    PixelBuffer out_data = allocPixels((size_t)outWidth * outHeight * 4);
+    if (!out_data) return nullptr;
+
+    size_t stride = (size_t)width * 4;
+    for (int y = 0; y < outHeight; ++y) {
+        const uint8_t* top = in_data + (size_t)(2 * y) * stride;
+        const uint8_t* bottom = top + stride;
+        uint8_t* out = out_data.get() + (size_t)y * outWidth * 4;
+        int x = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+        // Average the two rows, then each horizontal pair of pixels
+        for (; x + 2 <= outWidth; x += 2) {
+            __m128i v = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(top + x * 8)),
+                                     _mm_loadu_si128((const __m128i*)(bottom + x * 8)));
+            v = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storel_epi64((__m128i*)(out + x * 4), _mm_avg_epu8(v, _mm_srli_si128(v, 8)));
+        }
+#elif defined(__ARM_NEON)
+        for (; x + 2 <= outWidth; x += 2) {
+            uint8x16_t v = vrhaddq_u8(vld1q_u8(top + x * 8), vld1q_u8(bottom + x * 8));
+            uint32x4x2_t pairs = vuzpq_u32(vreinterpretq_u32_u8(v), vreinterpretq_u32_u8(v));
+            uint8x8_t even = vreinterpret_u8_u32(vget_low_u32(pairs.val[0]));
+            uint8x8_t odd = vreinterpret_u8_u32(vget_low_u32(pairs.val[1]));
+            vst1_u8(out + x * 4, vrhadd_u8(even, odd));
+        }
+#endif
+        for (; x < outWidth; ++x) {
+            // Same rounding as the vector averages, so all columns agree
+            for (int c = 0; c < 4; ++c) {
+                int left = (top[x * 8 + c] + bottom[x * 8 + c] + 1) >> 1;
+                int right = (top[x * 8 + 4 + c] + bottom[x * 8 + 4 + c] + 1) >> 1;
+                out[x * 4 + c] = (uint8_t)((left + right + 1) >> 1);
+            }
+        }
+    }
+    return out_data;
+}
+
+// ---------------------------------------------------------
+// Planar YUV
+// ---------------------------------------------------------
+
+// Bytes of a width x height I420 buffer, chroma rounds up for odd sizes
+size_t i420Bytes(int width, int height) {
+    return (size_t)width * height + 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2);
+}
+
+// Whether every pixel of an RGBA image is fully opaque. I420 has no alpha plane, so only these
+// can be stored planar without losing transparency.
+bool isOpaque(const unsigned char* rgba, int width, int height) {
+    size_t pixels = (size_t)width * height;
+    unsigned char all = 255;
+    for (size_t i = 0; i < pixels; ++i) all &= rgba[i * 4 + 3];
+    return all == 255;
+}
+
+/**
+ * Converts raw RGBA pixel data to planar YUV 4:2:0 with the full range BT.601 matrix JPEG
+ * uses, so the GPU's conversion gives back the decoder's colours. Chroma is taken from the
+ * average of each 2x2 block. Returns a newly allocated i420Bytes(width, height) buffer.
+ */
+PixelBuffer rgbaToI420(const unsigned char* in_data, int width, int height) {
+    int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    PixelBuffer out_data = allocPixels(i420Bytes(width, height));
+    if (!out_data) return nullptr;
+    uint8_t* yPlane = out_data.get();
+    uint8_t* uPlane = yPlane + (size_t)width * height;
+    uint8_t* vPlane = uPlane + (size_t)chromaWidth * chromaHeight;
+    size_t stride = (size_t)width * 4;
+
+    for (int y = 0; y < height; ++y) {
+        const uint8_t* src = in_data + (size_t)y * stride;
+        uint8_t* out = yPlane + (size_t)y * width;
+        for (int x = 0; x < width; ++x) {
+            out[x] = (uint8_t)((19595 * src[x * 4] + 38470 * src[x * 4 + 1] + 7471 * src[x * 4 + 2] + 32768) >> 16);
+        }
+    }
+
+    for (int cy = 0; cy < chromaHeight; ++cy) {
+        const uint8_t* top = in_data + (size_t)(2 * cy) * stride;
+        const uint8_t* bottom = (2 * cy + 1 < height) ? top + stride : top; // Odd heights repeat the last row
+        uint8_t* outU = uPlane + (size_t)cy * chromaWidth;
+        uint8_t* outV = vPlane + (size_t)cy * chromaWidth;
+        for (int cx = 0; cx < chromaWidth; ++cx) {
+            int left = 2 * cx * 4, right = std::min(2 * cx + 1, width - 1) * 4;
+            int r = top[left] + top[right] + bottom[left] + bottom[right];
+            int g = top[left + 1] + top[right + 1] + bottom[left + 1] + bottom[right + 1];
+            int b = top[left + 2] + top[right + 2] + bottom[left + 2] + bottom[right + 2];
+            // Sums of four pixels, the shift takes the extra factor of 4 out as well
+            int u = (-11059 * r - 21709 * g + 32768 * b + (128 << 18) + (1 << 17)) >> 18;
+            int v = (32768 * r - 27439 * g - 5329 * b + (128 << 18) + (1 << 17)) >> 18;
+            outU[cx] = (uint8_t)std::min(u, 255);
+            outV[cx] = (uint8_t)std::min(v, 255);
+        }
+    }
+    return out_data;
+}
+
+/**
+ * Converts planar YUV 4:2:0 back to opaque RGBA, the inverse of rgbaToI420.
+ * Returns a newly allocated width x height RGBA buffer.
+ */
+PixelBuffer i420ToRgba(const unsigned char* in_data, int width, int height) {
+    int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    PixelBuffer out_data = allocPixels((size_t)width * height * 4);
+    if (!out_data) return nullptr;
+    const uint8_t* uPlane = in_data + (size_t)width * height;
+    const uint8_t* vPlane = uPlane + (size_t)chromaWidth * chromaHeight;
+
+    for (int y = 0; y < height; ++y) {
+        const uint8_t* luma = in_data + (size_t)y * width;
+        const uint8_t* u = uPlane + (size_t)(y / 2) * chromaWidth;
+        const uint8_t* v = vPlane + (size_t)(y / 2) * chromaWidth;
+        uint8_t* out = out_data.get() + (size_t)y * width * 4;
+        for (int x = 0; x < width; ++x) {
+            int l = luma[x] * 65536 + 32768, cb = u[x / 2] - 128, cr = v[x / 2] - 128;
+            out[x * 4] = (uint8_t)std::clamp((l + 91881 * cr) >> 16, 0, 255);
+            out[x * 4 + 1] = (uint8_t)std::clamp((l - 22554 * cb - 46802 * cr) >> 16, 0, 255);
+            out[x * 4 + 2] = (uint8_t)std::clamp((l + 116130 * cb) >> 16, 0, 255);
+            out[x * 4 + 3] = 255;
+        }
+    }
+    return out_data;
+}
+
+// ---------------------------------------------------------
+// Packed Images
+// ---------------------------------------------------------
+
+// Lossless coding of I420 planes for the in-memory tier below the decode cache. Each sample is
+// predicted from its neighbours with the LOCO-I median edge detector, and the residuals are
+// Rice coded in blocks of kPackBlock with one parameter per block. Photos come out at roughly
+// half their planar size, and unpacking is a fraction of the cost of a JPEG decode.
+const int kPackBlock = 32;
+const int kPackEscape = 15; // Unary prefixes this long are followed by the raw residual
+
+// Median edge prediction from the neighbours a (left), b (up) and c (up left): a + b - c clamped
+// to between a and b. The min / max are done with masks, compilers turn std::min into branches
+// here and those mispredict on every other sample of a noisy photo.
+inline int predictSample(int a, int b, int c) {
+    int d = a - b, lo = b + (d & (d >> 31)), hi = a - (d & (d >> 31));
+    int p = a + b - c;
+    p -= (p - hi) & ~((p - hi) >> 31);
+    p += (lo - p) & ~((lo - p) >> 31);
+    return p;
+}
+
+// Residuals mapped to 0..255 with small magnitudes first: 0, -1, 1, -2, ...
+inline uint8_t zigzag(uint8_t residual) {
+    return (uint8_t)((residual << 1) ^ (0u - (residual >> 7)));
+}
+
+inline uint8_t unzigzag(uint8_t z) {
+    return (uint8_t)((z >> 1) ^ (0u - (z & 1)));
+}
+
+// Bits are written LSB first into a buffer sized for the worst case up front
+struct BitWriter {
+    uint8_t* out;
+    uint64_t bits = 0;
+    int count = 0;
+
+    void put(uint32_t value, int length) {
+        bits |= (uint64_t)value << count;
+        count += length;
+        if (count >= 32) {
+            uint32_t word = (uint32_t)bits;
+            for (int i = 0; i < 4; ++i) out[i] = (uint8_t)(word >> (8 * i));
+            out += 4;
+            bits >>= 32;
+            count -= 32;
+        }
+    }
+    void flush() {
+        for (; count > 0; count -= 8, bits >>= 8) *out++ = (uint8_t)bits;
+    }
+};
+
+// Number of consecutive one bits from the bottom of a byte
+struct TrailingOnes {
+    uint8_t counts[256];
+    TrailingOnes() {
+        for (int i = 0; i < 256; ++i) {
+            int n = 0;
+            while (n < 8 && (i >> n) & 1) ++n;
+            counts[i] = (uint8_t)n;
+        }
+    }
+};
+const TrailingOnes kTrailingOnes;
+
+struct BitReader {
+    const uint8_t* data;
+    size_t size;
+    size_t pos = 0;
+    uint64_t bits = 0;
+    int count = 0;
+
+    // At least 32 bits buffered, zeros past the end
+    void refill() {
+        if (count >= 32) return;
+        uint32_t word = 0;
+        for (int i = 0; i < 4; ++i) word |= (uint32_t)(pos + i < size ? data[pos + i] : 0) << (8 * i);
+        bits |= (uint64_t)word << count;
+        pos += 4;
+        count += 32;
+    }
+    uint32_t take(int length) {
+        uint32_t value = (uint32_t)(bits & ((1ull << length) - 1));
+        bits >>= length;
+        count -= length;
+        return value;
+    }
+};
+
+// Zigzagged prediction residuals of one row
+void rowResiduals(const uint8_t* row, const uint8_t* previous, int width, uint8_t* residuals) {
+    if (!previous) {
+        residuals[0] = zigzag((uint8_t)(row[0] - 128));
+        for (int x = 1; x < width; ++x) residuals[x] = zigzag((uint8_t)(row[x] - row[x - 1]));
+        return;
+    }
+    residuals[0] = zigzag((uint8_t)(row[0] - previous[0]));
+    for (int x = 1; x < width; ++x) {
+        residuals[x] = zigzag((uint8_t)(row[x] - predictSample(row[x - 1], previous[x], previous[x - 1])));
+    }
+}
+
+// Upper bound of the packed size of a plane: every sample escaped, plus the block parameters
+size_t packedPlaneBound(int width, int height) {
+    return (size_t)width * height * 3 + (size_t)height * (width / kPackBlock + 1) + 8;
+}
+
+void packPlane(const uint8_t* plane, int width, int height, BitWriter& writer) {
+    std::vector<uint8_t> residuals(width);
+    for (int y = 0; y < height; ++y) {
+        const uint8_t* row = plane + (size_t)y * width;
+        rowResiduals(row, y ? row - width : nullptr, width, residuals.data());
+
+        for (int start = 0; start < width; start += kPackBlock) {
+            int count = std::min(kPackBlock, width - start);
+            int sum = 0;
+            for (int i = 0; i < count; ++i) sum += residuals[start + i];
+            int k = 0;
+            while (k < 7 && (count << (k + 1)) <= sum) ++k;
+            writer.put(k, 3);
+            for (int i = 0; i < count; ++i) {
+                uint32_t z = residuals[start + i], q = z >> k;
+                if (q < (uint32_t)kPackEscape) {
+                    // q ones, the terminating zero, then the low k bits
+                    writer.put(((1u << q) - 1) | ((z & ((1u << k) - 1)) << (q + 1)), q + 1 + k);
+                } else {
+                    writer.put(((1u << kPackEscape) - 1) | (z << kPackEscape), kPackEscape + 8);
+                }
+            }
+        }
+    }
+}
+
+bool unpackPlane(BitReader& reader, uint8_t* plane, int width, int height) {
+    for (int y = 0; y < height; ++y) {
+        uint8_t* row = plane + (size_t)y * width;
+        const uint8_t* previous = y ? row - width : nullptr;
+        for (int start = 0; start < width; start += kPackBlock) {
+            int count = std::min(kPackBlock, width - start);
+            reader.refill();
+            int k = (int)reader.take(3);
+            for (int x = start; x < start + count; ++x) {
+                reader.refill();
+                int q = kTrailingOnes.counts[reader.bits & 0xFF];
+                if (q == 8) q = std::min(kPackEscape, 8 + kTrailingOnes.counts[(reader.bits >> 8) & 0xFF]);
+                uint32_t z;
+                if (q < kPackEscape) {
+                    reader.take(q + 1);
+                    z = ((uint32_t)q << k) | reader.take(k);
+                    if (z > 255) return false;
+                } else {
+                    reader.take(kPackEscape);
+                    z = reader.take(8);
+                }
+                int prediction;
+                if (!previous) prediction = x ? row[x - 1] : 128;
+                else if (!x) prediction = previous[0];
+                else prediction = predictSample(row[x - 1], previous[x], previous[x - 1]);
+                row[x] = (uint8_t)(prediction + unzigzag((uint8_t)z));
+            }
+        }
+        if (reader.pos > reader.size + 8) return false; // Ran past the end of the data
+    }
+    return true;
+}
+
+// Packs a width x height I420 buffer. The worst case scratch space is kept per thread,
+// faulting in fresh pages for it on every call costs as much as the packing.
+std::vector<uint8_t> packI420(const unsigned char* planes, int width, int height) {
+    int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    static thread_local std::vector<uint8_t> scratch;
+    scratch.resize(std::max(scratch.size(), packedPlaneBound(width, height) + 2 * packedPlaneBound(chromaWidth, chromaHeight)));
+    BitWriter writer{ scratch.data() };
+    const unsigned char* u = planes + (size_t)width * height;
+    packPlane(planes, width, height, writer);
+    packPlane(u, chromaWidth, chromaHeight, writer);
+    packPlane(u + (size_t)chromaWidth * chromaHeight, chromaWidth, chromaHeight, writer);
+    writer.flush();
+    return std::vector<uint8_t>(scratch.data(), writer.out);
+}
+
+// Inverse of packI420. Returns nullptr if the data doesn't decode to that size.
+PixelBuffer unpackI420(const std::vector<uint8_t>& packed, int width, int height) {
+    int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    PixelBuffer planes = allocPixels(i420Bytes(width, height));
+    if (!planes) return nullptr;
+    BitReader reader{ packed.data(), packed.size() };
+    unsigned char* u = planes.get() + (size_t)width * height;
+    if (!unpackPlane(reader, planes.get(), width, height) ||
+        !unpackPlane(reader, u, chromaWidth, chromaHeight) ||
+        !unpackPlane(reader, u + (size_t)chromaWidth * chromaHeight, chromaWidth, chromaHeight)) {
+        return nullptr;
+    }
+    return planes;
+}
+
+// ---------------------------------------------------------
+// Perceptual Hash
+// ---------------------------------------------------------
+
+struct ImageSignature {
+    uint64_t hash = 0;      // dHash: brightness gradients of a 9x8 grid, one bit each
+    float sharpness = 0.0f; // Mean squared Laplacian of the luma, higher is sharper
+};
+
+// Hamming distance between two hashes still counted as the same shot
+const size_t kBurstDistance = 10;
+
+/**
+ * Mean squared Laplacian over the interior of a luma plane. Focus and motion blur
+ * flatten the second derivative, so within a burst the sharpest frame scores highest.
+ */
+float lumaSharpness(const uint8_t* luma, int width, int height) {
+    if (width < 3 || height < 3) return 0.0f;
+    uint64_t total = 0;
+    for (int y = 1; y + 1 < height; ++y) {
+        const uint8_t* row = luma + (size_t)y * width;
+        const uint8_t* up = row - width;
+        const uint8_t* down = row + width;
+        int x = 1;
+#if defined(__SSE2__) || defined(_M_X64)
+        // 4c - l - r - u - d fits 16 bits, madd squares and sums pairs into 32 bit lanes.
+        // Lanes are flushed every 512 steps so they can't overflow.
+        const __m128i zero = _mm_setzero_si128();
+        while (x + 8 < width) {
+            __m128i acc = zero;
+            for (int step = 0; step < 512 && x + 8 < width; ++step, x += 8) {
+                __m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(row + x)), zero);
+                __m128i l = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(row + x - 1)), zero);
+                __m128i r = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(row + x + 1)), zero);
+                __m128i u = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(up + x)), zero);
+                __m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(down + x)), zero);
+                __m128i lap = _mm_sub_epi16(_mm_slli_epi16(c, 2), _mm_add_epi16(_mm_add_epi16(l, r), _mm_add_epi16(u, d)));
+                acc = _mm_add_epi32(acc, _mm_madd_epi16(lap, lap));
+            }
+            alignas(16) uint32_t lanes[4];
+            _mm_store_si128((__m128i*)lanes, acc);
+            total += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+#elif defined(__ARM_NEON)
+        while (x + 8 < width) {
+            uint32x4_t acc = vdupq_n_u32(0);
+            for (int step = 0; step < 256 && x + 8 < width; ++step, x += 8) {
+                int16x8_t c = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(row + x)));
+                int16x8_t l = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(row + x - 1)));
+                int16x8_t r = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(row + x + 1)));
+                int16x8_t u = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(up + x)));
+                int16x8_t d = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(down + x)));
+                int16x8_t lap = vsubq_s16(vshlq_n_s16(c, 2), vaddq_s16(vaddq_s16(l, r), vaddq_s16(u, d)));
+                int32x4_t squares = vmull_s16(vget_low_s16(lap), vget_low_s16(lap));
+                squares = vmlal_s16(squares, vget_high_s16(lap), vget_high_s16(lap));
+                acc = vaddq_u32(acc, vreinterpretq_u32_s32(squares));
+            }
+            total += (uint64_t)vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) + vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+        }
+#endif
+        for (; x + 1 < width; ++x) {
+            int lap = 4 * row[x] - row[x - 1] - row[x + 1] - up[x] - down[x];
+            total += (uint64_t)(lap * lap);
+        }
+    }
+    return (float)((double)total / ((double)(width - 2) * (height - 2)));
+}
+
+/**
+ * Perceptual hash and sharpness of raw RGBA pixel data, computed on its luma.
+ * The hash compares horizontally adjacent cells of a 9x8 box averaged grid, so
+ * it survives the small shifts and exposure changes between frames of a burst.
+ */
+ImageSignature imageSignature(const unsigned char* pixels, int width, int height) {
+    ImageSignature signature;
+    if (width < 9 || height < 8) return signature;
+
+    thread_local std::vector<uint8_t> luma;
+    luma.resize((size_t)width * height);
+    for (size_t i = 0; i < luma.size(); ++i) {
+        const unsigned char* p = pixels + i * 4;
+        luma[i] = (uint8_t)((p[0] + 2 * p[1] + p[2]) >> 2);
+    }
+
+    std::vector<int> cellOf(width);
+    for (int x = 0; x < width; ++x) cellOf[x] = x * 9 / width;
+    uint64_t sums[8][9] = {};
+    uint64_t counts[8][9] = {};
+    // Every other row and column is plenty for 72 averages. Below two samples per cell that
+    // could leave a cell empty, so small images are read whole.
+    int stepX = width >= 18 ? 2 : 1;
+    int stepY = height >= 16 ? 2 : 1;
+    for (int y = 0; y < height; y += stepY) {
+        int cellY = y * 8 / height;
+        const uint8_t* row = luma.data() + (size_t)y * width;
+        for (int x = 0; x < width; x += stepX) {
+            sums[cellY][cellOf[x]] += row[x];
+            counts[cellY][cellOf[x]]++;
+        }
+    }
+    for (int y = 0; y < 8; ++y) {
+        for (int x = 0; x < 8; ++x) {
+            // Cross multiplied to compare the averages without dividing
+            if (sums[y][x + 1] * counts[y][x] > sums[y][x] * counts[y][x + 1]) {
+                signature.hash |= (uint64_t)1 << (y * 8 + x);
+            }
+        }
+    }
+    signature.sharpness = lumaSharpness(luma.data(), width, height);
+    return signature;
+}
+
+// ---------------------------------------------------------
+// JPEG Fast Path
+// ---------------------------------------------------------
+
+// Size of a decode, and of the source image it came from
+struct DecodedSize {
+    int width = 0;
+    int height = 0;
+    int fullWidth = 0;
+    int fullHeight = 0;
+};
+
+// A whole file in memory. Large files are mapped and prefaulted in one go, small ones
+// are read with a single pread into a per-thread buffer that is reused across files.
+struct MappedFile {
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+    void close() {
+#ifndef _WIN32
+        if (map) munmap(map, length);
+#endif
+        map = nullptr;
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const unsigned char* bytes = nullptr;
+    size_t length = 0;
+    void* map = nullptr; // mmap base when mapped
+};
+
+// Below this a read is cheaper than setting up and tearing down a mapping
+const size_t kMapThreshold = 256 * 1024;
+
+// Opens the first limit bytes of a file, all of it by default
+bool openFile(const std::string& path, MappedFile& out, size_t limit = SIZE_MAX) {
+    out.close();
+    thread_local std::vector<unsigned char> buffer;
+#ifdef _WIN32
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size <= 0) {
+        fclose(f);
+        return false;
+    }
+    buffer.resize(std::min((size_t)size, limit));
+    size_t got = fread(buffer.data(), 1, buffer.size(), f);
+    fclose(f);
+    if (got != buffer.size()) return false;
+    out.bytes = buffer.data();
+    out.length = buffer.size();
+    return true;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+    size_t size = std::min((size_t)st.st_size, limit);
+
+    if (size >= kMapThreshold) {
+#ifdef MAP_POPULATE
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+#else
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) madvise(map, size, MADV_WILLNEED);
+#endif
+        if (map != MAP_FAILED) {
+            ::close(fd);
+            out.map = map;
+            out.bytes = (const unsigned char*)map;
+            out.length = size;
+            return true;
+        }
+    }
+
+    // Small file, or the mapping failed
+    if (buffer.size() < size) buffer.resize(size);
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = pread(fd, buffer.data() + got, size - got, (off_t)got);
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    ::close(fd);
+    if (got != size) return false;
+    out.bytes = buffer.data();
+    out.length = size;
+    return true;
+#endif
+}
+
+// Asks the kernel to start reading a file we expect to open soon
+void hintReadahead(const std::string& path) {
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    ::close(fd);
+#else
+    (void)path;
+#endif
+}
+
+bool isJpegData(const unsigned char* data, size_t size) {
+    return size > 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+}
+
+struct ExifInfo {
+    int orientation = 1;        // TIFF Orientation tag, 1-8
+    size_t orientationOffset = 0; // File offset of the tag's value, 0 if the file has no tag
+    bool littleEndian = false;  // Byte order of the TIFF block holding it
+    size_t thumbnailOffset = 0; // File offset of the embedded JPEG thumbnail
+    size_t thumbnailLength = 0;
+};
+
+// Bounds-checked reads from a TIFF block in either byte order
+struct TiffReader {
+    const unsigned char* data;
+    size_t size;
+    bool littleEndian;
+
+    unsigned u16(size_t offset) const {
+        if (offset + 2 > size) return 0;
+        const unsigned char* p = data + offset;
+        return littleEndian ? (p[0] | (p[1] << 8)) : ((p[0] << 8) | p[1]);
+    }
+    unsigned u32(size_t offset) const {
+        if (offset + 4 > size) return 0;
+        const unsigned char* p = data + offset;
+        return littleEndian ? (p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24))
+                            : (((unsigned)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+    }
+};
+
+// Parses the TIFF structure inside an Exif segment. tiffBase is the file offset of the TIFF header.
+bool parseTiff(const unsigned char* data, size_t size, size_t tiffBase, ExifInfo& info) {
+    if (size < 8) return false;
+    TiffReader tiff = { data, size, data[0] == 'I' };
+    if ((data[0] != 'I' && data[0] != 'M') || data[0] != data[1] || tiff.u16(2) != 42) return false;
+
+    // IFD0 describes the main image, the IFD it links to (IFD1) describes the thumbnail
+    size_t ifd0 = tiff.u32(4);
+    unsigned ifd0Count = tiff.u16(ifd0);
+    for (unsigned i = 0; i < ifd0Count; ++i) {
+        size_t entry = ifd0 + 2 + i * 12;
+        if (tiff.u16(entry) == 0x0112 && entry + 10 <= size) { // Orientation, a SHORT stored inline
+            unsigned orientation = tiff.u16(entry + 8);
+            if (orientation >= 1 && orientation <= 8) info.orientation = (int)orientation;
+            info.orientationOffset = tiffBase + entry + 8;
+            info.littleEndian = tiff.littleEndian;
+        }
+    }
+    size_t ifd1 = tiff.u32(ifd0 + 2 + ifd0Count * 12);
+    if (ifd1 == 0 || ifd1 >= size) return true;
+
+    unsigned ifd1Count = tiff.u16(ifd1);
+    size_t thumbOffset = 0, thumbLength = 0;
+    for (unsigned i = 0; i < ifd1Count; ++i) {
+        size_t entry = ifd1 + 2 + i * 12;
+        unsigned tag = tiff.u16(entry);
+        if (tag == 0x0201) thumbOffset = tiff.u32(entry + 8); // JPEGInterchangeFormat
+        if (tag == 0x0202) thumbLength = tiff.u32(entry + 8); // JPEGInterchangeFormatLength
+    }
+    if (thumbOffset && thumbLength && thumbOffset + thumbLength <= size) {
+        info.thumbnailOffset = tiffBase + thumbOffset;
+        info.thumbnailLength = thumbLength;
+    }
+    return true;
+}
+
+// Reads the APP1 Exif segment of a JPEG without decoding any pixels
+bool parseExif(const unsigned char* data, size_t size, ExifInfo& info) {
+    if (!isJpegData(data, size)) return false;
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) return false;
+        unsigned char marker = data[pos + 1];
+        if (marker == 0xFF) { pos++; continue; } // Fill byte
+        if (marker == 0xDA || marker == 0xD9) return false; // Start of scan, metadata is over
+        size_t length = (data[pos + 2] << 8) | data[pos + 3];
+        if (length < 2 || pos + 2 + length > size) return false;
+
+        const unsigned char* segment = data + pos + 4;
+        size_t segmentLength = length - 2;
+        if (marker == 0xE1 && segmentLength > 14 && memcmp(segment, "Exif\0\0", 6) == 0) {
+            return parseTiff(segment + 6, segmentLength - 6, pos + 4 + 6, info);
+        }
+        pos += 2 + length;
+    }
+    return false;
+}
+
+// Largest IDCT downscale (1, 2, 4 or 8) that still covers the image fitted to the target size
+int chooseScaleDenom(int width, int height, int targetWidth, int targetHeight) {
+    double fit = std::min((double)targetWidth / width, (double)targetHeight / height);
+    int denom = 1;
+    while (denom < 8 && fit * denom * 2 <= 1.0) denom *= 2;
+    return denom;
+}
+
+// Size an image is drawn at when fitted to the window, in stored (unrotated) orientation.
+// Sideways orientations are fitted against the rotated window.
+SDL_Rect fitToTarget(int fullWidth, int fullHeight, int orientation) {
+    int targetWidth = g_targetWidth, targetHeight = g_targetHeight;
+    if (orientationTransform(orientation).quarterTurns % 2) std::swap(targetWidth, targetHeight);
+    return fitToWindow(fullWidth, fullHeight, targetWidth, targetHeight);
+}
+
+#ifdef FIV_USE_LIBJPEG
+struct JpegErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+void jpegErrorExit(j_common_ptr cinfo) {
+    longjmp(((JpegErrorManager*)cinfo->err)->jump, 1);
+}
+
+void jpegSilentMessage(j_common_ptr) {}
+
+// Decodes a JPEG to RGBA with libjpeg-turbo, scaling in the DCT domain so it
+// just covers the target size. Returns nullptr on failure.
+PixelBuffer decodeJpegScaled(const unsigned char* buf, size_t size, int targetWidth, int targetHeight, DecodedSize& out) {
+    jpeg_decompress_struct cinfo;
+    JpegErrorManager err;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = jpegErrorExit;
+    err.pub.output_message = jpegSilentMessage;
+    unsigned char* volatile pixels = nullptr;
+
+    if (setjmp(err.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        pixelFree(pixels);
+        return nullptr;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, buf, (unsigned long)size);
+    jpeg_read_header(&cinfo, TRUE);
+
+    int denom = (targetWidth > 0 && targetHeight > 0)
+        ? chooseScaleDenom(cinfo.image_width, cinfo.image_height, targetWidth, targetHeight) : 1;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = denom;
+    cinfo.out_color_space = JCS_EXT_RGBA;
+    jpeg_start_decompress(&cinfo);
+
+    size_t stride = (size_t)cinfo.output_width * 4;
+    pixels = (unsigned char*)pixelAlloc(stride * cinfo.output_height);
+    if (!pixels) {
+        jpeg_destroy_decompress(&cinfo);
+        return nullptr;
+    }
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = pixels + stride * cinfo.output_scanline;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+
+    out.width = cinfo.output_width;
+    out.height = cinfo.output_height;
+    out.fullWidth = cinfo.image_width;
+    out.fullHeight = cinfo.image_height;
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return PixelBuffer(pixels);
+}
+#endif
+
+// ---------------------------------------------------------
+// Decoders
+// ---------------------------------------------------------
+
+// A decoder backend. decode returns RGBA pixels in a pooled buffer, or nullptr on failure.
+// Given a target size it may decode at a reduced scale, as long as the result covers it.
+struct DecoderBackend {
+    const char* name;
+    bool (*accepts)(const unsigned char* data, size_t size);
+    PixelBuffer (*decode)(const unsigned char* data, size_t size, int targetWidth, int targetHeight, DecodedSize& out);
+};
+
+bool acceptsAnything(const unsigned char*, size_t) {
+    return true;
+}
+
+#ifdef FIV_USE_NVJPEG
+// One nvJPEG handle for the process, created on first use. Decode state, stream and
+// the device and pinned staging buffers are per decode thread and grow as needed.
+nvjpegHandle_t g_nvjpeg = nullptr;
+std::once_flag g_nvjpegInit;
+
+struct NvjpegThreadState {
+    nvjpegJpegState_t state = nullptr;
+    cudaStream_t stream = nullptr;
+    unsigned char* device = nullptr; // Interleaved RGB output
+    size_t deviceBytes = 0;
+    unsigned char* pinned = nullptr; // Host copy of the output
+    size_t pinnedBytes = 0;
+};
+
+bool nvjpegAvailable() {
+    std::call_once(g_nvjpegInit, [] {
+        if (nvjpegCreateSimple(&g_nvjpeg) != NVJPEG_STATUS_SUCCESS) {
+            g_nvjpeg = nullptr;
+            std::cerr << "nvJPEG unavailable, decoding on the CPU." << std::endl;
+        }
+    });
+    return g_nvjpeg != nullptr;
+}
+
+bool acceptsJpegOnGpu(const unsigned char* data, size_t size) {
+    return isJpegData(data, size) && nvjpegAvailable();
+}
+
+// Reports a failed CUDA call, returning whether it succeeded
+bool cudaSucceeded(cudaError_t err, const char* what) {
+    if (err == cudaSuccess) return true;
+    std::cerr << what << " failed: " << cudaGetErrorString(err) << std::endl;
+    return false;
+}
+
+// nvJPEG has no RGBA output, widen its interleaved RGB
+void expandRgbToRgba(const unsigned char* rgb, unsigned char* rgba, size_t pixels) {
+    for (size_t i = 0; i < pixels; ++i) {
+        rgba[i * 4 + 0] = rgb[i * 3 + 0];
+        rgba[i * 4 + 1] = rgb[i * 3 + 1];
+        rgba[i * 4 + 2] = rgb[i * 3 + 2];
+        rgba[i * 4 + 3] = 255;
+    }
+}
+
+// Decodes at full resolution on the GPU. With the CPU scaled IDCT available, images it
+// can shrink are declined, decoding a quarter of the pixels there beats a full GPU decode
+// followed by a CPU resample.
+PixelBuffer decodeWithNvjpeg(const unsigned char* data, size_t size, int targetWidth, int targetHeight, DecodedSize& out) {
+    int components = 0;
+    nvjpegChromaSubsampling_t subsampling;
+    int widths[NVJPEG_MAX_COMPONENT], heights[NVJPEG_MAX_COMPONENT];
+    if (nvjpegGetImageInfo(g_nvjpeg, data, size, &components, &subsampling, widths, heights) != NVJPEG_STATUS_SUCCESS) {
+        return nullptr;
+    }
+    int width = widths[0], height = heights[0];
+#ifdef FIV_USE_LIBJPEG
+    if (targetWidth > 0 && targetHeight > 0 && chooseScaleDenom(width, height, targetWidth, targetHeight) > 1) return nullptr;
+#else
+    (void)targetWidth;
+    (void)targetHeight;
+#endif
+
+    thread_local NvjpegThreadState t;
+    if (!t.state) {
+        if (nvjpegJpegStateCreate(g_nvjpeg, &t.state) != NVJPEG_STATUS_SUCCESS) return nullptr;
+        cudaStreamCreateWithFlags(&t.stream, cudaStreamNonBlocking);
+    }
+
+    size_t pitch = (size_t)width * 3;
+    size_t bytes = pitch * height;
+    // The old buffer is forgotten as soon as it is freed, a failed allocation must not
+    // leave a pointer behind for the next call to free again
+    if (t.deviceBytes < bytes) {
+        bool freed = cudaSucceeded(cudaFree(t.device), "cudaFree");
+        t.device = nullptr;
+        t.deviceBytes = 0;
+        if (!freed) return nullptr;
+        if (!cudaSucceeded(cudaMalloc((void**)&t.device, bytes), "cudaMalloc")) {
+            t.device = nullptr;
+            return nullptr;
+        }
+        t.deviceBytes = bytes;
+    }
+    if (t.pinnedBytes < bytes) {
+        bool freed = cudaSucceeded(cudaFreeHost(t.pinned), "cudaFreeHost");
+        t.pinned = nullptr;
+        t.pinnedBytes = 0;
+        if (!freed) return nullptr;
+        if (!cudaSucceeded(cudaMallocHost((void**)&t.pinned, bytes), "cudaMallocHost")) {
+            t.pinned = nullptr;
+            return nullptr;
+        }
+        t.pinnedBytes = bytes;
+    }
+
+    nvjpegImage_t image = {};
+    image.channel[0] = t.device;
+    image.pitch[0] = pitch;
+    if (nvjpegDecode(g_nvjpeg, t.state, data, size, NVJPEG_OUTPUT_RGBI, &image, t.stream) != NVJPEG_STATUS_SUCCESS) {
+        return nullptr;
+    }
+    cudaMemcpyAsync(t.pinned, t.device, bytes, cudaMemcpyDeviceToHost, t.stream);
+    if (cudaStreamSynchronize(t.stream) != cudaSuccess) return nullptr;
+
+    PixelBuffer pixels = allocPixels((size_t)width * height * 4);
+    if (!pixels) return nullptr;
+    expandRgbToRgba(t.pinned, pixels.get(), (size_t)width * height);
+    out.width = out.fullWidth = width;
+    out.height = out.fullHeight = height;
+    return pixels;
+}
+#endif
+
+// stb always decodes at full resolution
+PixelBuffer decodeWithStb(const unsigned char* data, size_t size, int, int, DecodedSize& out) {
+    int channels = 0;
+    PixelBuffer pixels(stbi_load_from_memory(data, (int)size, &out.width, &out.height, &channels, 4));
+    out.fullWidth = out.width;
+    out.fullHeight = out.height;
+    return pixels;
+}
+
+// Backends in order of preference, chosen at build time. stb takes whatever the others don't.
+const DecoderBackend kDecoders[] = {
+#ifdef FIV_USE_NVJPEG
+    { "nvjpeg", acceptsJpegOnGpu, decodeWithNvjpeg },
+#endif
+#ifdef FIV_USE_LIBJPEG
+    { "libjpeg-turbo", isJpegData, decodeJpegScaled },
+#endif
+    { "stb_image", acceptsAnything, decodeWithStb },
+};
+
+// Decodes with the first backend that accepts the data and succeeds
+PixelBuffer decodeImage(const unsigned char* data, size_t size, int targetWidth, int targetHeight, DecodedSize& out) {
+    for (const DecoderBackend& backend : kDecoders) {
+        if (!backend.accepts(data, size)) continue;
+        PixelBuffer pixels = backend.decode(data, size, targetWidth, targetHeight, out);
+        if (pixels) {
+            recordDecoder(backend.name);
+            return pixels;
+        }
+    }
+    return nullptr;
+}
+
+// ---------------------------------------------------------
+// Preview Cache
+// ---------------------------------------------------------
+
+// Screen sized previews persisted across runs, one file per source image named by a hash
+// of its path, mtime and size. The RGBA pixels follow a fixed header and the source path,
+// so a warm start maps the file and copies the pixels out instead of decoding the JPEG.
+struct PreviewHeader {
+    char magic[4];          // "FIVP"
+    uint32_t version;
+    uint64_t sourceSize;
+    int64_t sourceMtime;    // Nanoseconds since the epoch
+    int32_t width;          // Preview size, in stored orientation
+    int32_t height;
+    int32_t fullWidth;      // Source size
+    int32_t fullHeight;
+    int32_t orientation;    // EXIF orientation of the source
+    uint32_t pathLength;    // Length of the source path following the header
+    uint64_t hash;          // ImageSignature of the preview when hashed is set
+    float sharpness;
+    uint32_t hashed;
+};
+// Written as is. The fields leave no padding, so no uninitialised bytes reach the disk.
+static_assert(sizeof(PreviewHeader) == 64, "preview headers are written as is");
+
+const uint32_t kPreviewVersion = 2;
+
+// Identifies a version of a source file
+struct SourceStamp {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+// $XDG_CACHE_HOME/fastimageviewer, else ~/.cache/fastimageviewer
+fs::path defaultDiskCacheDir() {
+#ifdef _WIN32
+    return {};
+#else
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg) return fs::path(xdg) / "fastimageviewer";
+    const char* home = getenv("HOME");
+    if (home && *home) return fs::path(home) / ".cache" / "fastimageviewer";
+    return {};
+#endif
+}
+
+bool statSource(const std::string& path, SourceStamp& stamp) {
+#ifdef _WIN32
+    return false;
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    stamp.size = (uint64_t)st.st_size;
+#ifdef __APPLE__
+    stamp.mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    stamp.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return true;
+#endif
+}
+
+// FNV-1a, chained through hash to cover several fields
+uint64_t hashBytes(const void* bytes, size_t size, uint64_t hash = 1469598103934665603ull) {
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= ((const unsigned char*)bytes)[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Cache file for a hash, e.g. 0123456789abcdef.fivp
+fs::path diskCachePath(uint64_t hash, const char* extension) {
+    char name[48];
+    snprintf(name, sizeof(name), "%016llx.%s", (unsigned long long)hash, extension);
+    return g_diskCacheDir / name;
+}
+
+// Named by the path and stamp, a changed file gets a new name and the stale one is never read
+fs::path previewPath(const std::string& sourcePath, const SourceStamp& stamp) {
+    uint64_t hash = hashBytes(sourcePath.data(), sourcePath.size());
+    hash = hashBytes(&stamp.size, sizeof(stamp.size), hash);
+    hash = hashBytes(&stamp.mtime, sizeof(stamp.mtime), hash);
+    return diskCachePath(hash, "fivp");
+}
+
+// Maps a cached preview and copies its pixels into a pooled buffer.
+// Returns nullptr if there is none, or it belongs to another file or version.
+PixelBuffer loadCachedPreview(const std::string& sourcePath, const SourceStamp& stamp, PreviewHeader& header) {
+#ifdef _WIN32
+    return nullptr;
+#else
+    int fd = open(previewPath(sourcePath, stamp).c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+
+    PixelBuffer pixels;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(PreviewHeader)) {
+        size_t size = (size_t)st.st_size;
+#ifdef MAP_POPULATE
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+#else
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+#endif
+        if (map != MAP_FAILED) {
+            const unsigned char* bytes = (const unsigned char*)map;
+            memcpy(&header, bytes, sizeof(header));
+            size_t pixelBytes = (size_t)std::max(header.width, 0) * std::max(header.height, 0) * 4;
+            bool valid = memcmp(header.magic, "FIVP", 4) == 0 && header.version == kPreviewVersion &&
+                         header.sourceSize == stamp.size && header.sourceMtime == stamp.mtime &&
+                         header.width > 0 && header.height > 0 && header.pathLength == sourcePath.size() &&
+                         size == sizeof(header) + header.pathLength + pixelBytes &&
+                         memcmp(bytes + sizeof(header), sourcePath.data(), header.pathLength) == 0;
+            if (valid) {
+                pixels = allocPixels(pixelBytes);
+                if (pixels) memcpy(pixels.get(), bytes + sizeof(header) + header.pathLength, pixelBytes);
+                // The file mtime is when the preview was last used, which is what the budget
+                // evicts by. An hour's resolution is plenty and spares most reads a write.
+                if (st.st_mtime < time(nullptr) - 3600) futimens(fd, nullptr);
+            }
+            munmap(map, size);
+        }
+    }
+    close(fd);
+    return pixels;
+#endif
+}
+
+// Name next to path to write a file under before renaming it into place. The process and thread
+// ids keep two viewers sharing the cache, or two loaders of one, off each other's temporary file.
+fs::path temporaryPath(const fs::path& path) {
+#ifdef _WIN32
+    long long pid = _getpid();
+#else
+    long long pid = getpid();
+#endif
+    fs::path tmpPath = path;
+    tmpPath += ".tmp" + std::to_string(pid) + "-" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    return tmpPath;
+}
+
+// Writes a preview next to the others. It goes to a temporary name first and is renamed
+// into place, so a concurrent reader never sees a partial file.
+void storeCachedPreview(const std::string& sourcePath, const SourceStamp& stamp, const unsigned char* pixels,
+                        int width, int height, int fullWidth, int fullHeight, int orientation,
+                        const ImageSignature* signature) {
+    PreviewHeader header = {};
+    memcpy(header.magic, "FIVP", 4);
+    header.version = kPreviewVersion;
+    header.sourceSize = stamp.size;
+    header.sourceMtime = stamp.mtime;
+    header.width = width;
+    header.height = height;
+    header.fullWidth = fullWidth;
+    header.fullHeight = fullHeight;
+    header.orientation = orientation;
+    header.pathLength = (uint32_t)sourcePath.size();
+    if (signature) {
+        header.hash = signature->hash;
+        header.sharpness = signature->sharpness;
+        header.hashed = 1;
+    }
+
+    fs::path path = previewPath(sourcePath, stamp);
+    fs::path tmpPath = temporaryPath(path);
+    FILE* f = fopen(tmpPath.string().c_str(), "wb");
+    if (!f) return;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(sourcePath.data(), 1, sourcePath.size(), f) == sourcePath.size() &&
+              fwrite(pixels, (size_t)width * 4, height, f) == (size_t)height;
+    ok = (fclose(f) == 0) && ok;
+
+    std::error_code ec;
+    if (ok) fs::rename(tmpPath, path, ec);
+    if (!ok || ec) {
+        fs::remove(tmpPath, ec);
+        return;
+    }
+    uint64_t fileBytes = sizeof(header) + sourcePath.size() + (uint64_t)width * height * 4;
+    if ((g_cacheSweeper.previewBytes += fileBytes) > g_diskCacheBudgetBytes) {
+        std::lock_guard<std::mutex> lock(g_cacheSweeper.mutex);
+        g_cacheSweeper.requested = true;
+        g_cacheSweeper.cv.notify_one();
+    }
+}
+
+// ---------------------------------------------------------
+// Preview Cache Budget
+// ---------------------------------------------------------
+
+// Whether a cached preview still matches its source file. Unreadable previews don't.
+bool previewIsCurrent(const fs::path& path) {
+    FILE* f = fopen(path.string().c_str(), "rb");
+    if (!f) return false;
+    PreviewHeader header;
+    std::string sourcePath;
+    bool read = fread(&header, sizeof(header), 1, f) == 1 && memcmp(header.magic, "FIVP", 4) == 0 &&
+                header.version == kPreviewVersion && header.pathLength < 65536;
+    if (read) {
+        sourcePath.resize(header.pathLength);
+        read = fread(&sourcePath[0], 1, sourcePath.size(), f) == sourcePath.size();
+    }
+    fclose(f);
+    SourceStamp stamp;
+    return read && statSource(sourcePath, stamp) && stamp.size == header.sourceSize && stamp.mtime == header.sourceMtime;
+}
+
+// Deletes abandoned temporary files and, when pruneStale is set, previews whose source changed
+// or went away. Then evicts the least recently used previews until they are back under 90% of
+// the budget, so the sweep doesn't have to run again on the very next write.
+void sweepPreviewCache(bool pruneStale) {
+    TraceScope scope("sweepPreviewCache");
+    struct Entry {
+        fs::file_time_type used;
+        uint64_t bytes;
+        fs::path path;
+    };
+    std::vector<Entry> previews;
+    uint64_t total = 0;
+    auto abandoned = fs::file_time_type::clock::now() - std::chrono::hours(1);
+    std::error_code ec;
+    for (fs::directory_iterator it(g_diskCacheDir, ec), end; !ec && it != end; it.increment(ec)) {
+        {
+            std::lock_guard<std::mutex> lock(g_cacheSweeper.mutex);
+            if (g_cacheSweeper.stopping) return;
+        }
+        const fs::path& path = it->path();
+        std::error_code entryEc;
+        fs::file_time_type used = it->last_write_time(entryEc);
+        uint64_t bytes = it->file_size(entryEc);
+        if (entryEc || !it->is_regular_file(entryEc)) continue;
+        if (path.filename().string().find(".tmp") != std::string::npos) {
+            // Left by a viewer that died mid write, a live one renames its file within moments
+            if (used < abandoned) fs::remove(path, entryEc);
+            continue;
+        }
+        if (path.extension() != ".fivp") continue; // Scan indexes are small and kept
+        if (pruneStale && !previewIsCurrent(path)) {
+            fs::remove(path, entryEc);
+            continue;
+        }
+        previews.push_back({ used, bytes, path });
+        total += bytes;
+    }
+
+    uint64_t target = g_diskCacheBudgetBytes / 10 * 9;
+    if (total > g_diskCacheBudgetBytes) {
+        std::sort(previews.begin(), previews.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+        for (const Entry& entry : previews) {
+            if (total <= target) break;
+            std::error_code removeEc;
+            if (fs::remove(entry.path, removeEc)) total -= entry.bytes;
+        }
+    }
+    g_cacheSweeper.previewBytes = total;
+}
+
+// Sweeps once at startup, stale entries included, then again whenever writes take the
+// previews over budget
+void cacheSweeper() {
+    setTraceThreadName("cache sweeper");
+    sweepPreviewCache(true);
+    std::unique_lock<std::mutex> lock(g_cacheSweeper.mutex);
+    while (true) {
+        g_cacheSweeper.cv.wait(lock, [] { return g_cacheSweeper.requested || g_cacheSweeper.stopping; });
+        if (g_cacheSweeper.stopping) return;
+        g_cacheSweeper.requested = false;
+        lock.unlock();
+        sweepPreviewCache(false);
+        lock.lock();
+    }
+}
+
+void startCacheSweeper() {
+    if (g_usePreviewCache && !g_diskCacheDir.empty()) g_cacheSweeper.thread = std::thread(cacheSweeper);
+}
+
+// Abandons a sweep in progress, what it has deleted so far stays deleted
+void stopCacheSweeper() {
+    {
+        std::lock_guard<std::mutex> lock(g_cacheSweeper.mutex);
+        g_cacheSweeper.stopping = true;
+    }
+    g_cacheSweeper.cv.notify_all();
+    if (g_cacheSweeper.thread.joinable()) g_cacheSweeper.thread.join();
+}
+
+// ---------------------------------------------------------
+// Directory Scan
+// ---------------------------------------------------------
+
+// Contents of one scanned directory. Adding, removing or renaming an entry bumps the
+// directory mtime, so an unchanged mtime means the cached listing is still exact.
+struct ScannedDir {
+    int64_t mtime = 0;
+    std::vector<std::string> files;   // Image files
+    std::vector<std::string> subdirs; // Only collected when scanning recursively
+};
+
+// Relative directory path ("" for the root) to its contents
+using ScanIndex = std::unordered_map<std::string, ScannedDir>;
+
+const char* kScanIndexMagic = "FIVS 1";
+
+// One cached index per root and mode
+fs::path scanIndexPath(const fs::path& root, bool recursive) {
+    std::string key = root.string() + (recursive ? "\n1" : "\n0");
+    return diskCachePath(hashBytes(key.data(), key.size()), "fivs");
+}
+
+// Text index: a "D <mtime> <dir>" line per directory followed by its "F <file>" and "S <subdir>" lines
+ScanIndex loadScanIndex(const fs::path& path) {
+    ScanIndex index;
+    std::ifstream in(path);
+    std::string line;
+    if (!std::getline(in, line) || line != kScanIndexMagic) return index;
+
+    ScannedDir* dir = nullptr;
+    while (std::getline(in, line)) {
+        if (line.size() < 2 || line[1] != ' ') return {};
+        if (line[0] == 'D') {
+            size_t space = line.find(' ', 2);
+            if (space == std::string::npos) return {};
+            ScannedDir& entry = index[line.substr(space + 1)];
+            entry.mtime = std::strtoll(line.c_str() + 2, nullptr, 10);
+            dir = &entry;
+        } else if (dir && line[0] == 'F') {
+            dir->files.push_back(line.substr(2));
+        } else if (dir && line[0] == 'S') {
+            dir->subdirs.push_back(line.substr(2));
+        } else {
+            return {};
+        }
+    }
+    return index;
+}
+
+// Written to a temporary name and renamed, like the previews. Directories with a
+// newline in an entry name are left out and simply get listed again next time.
+void storeScanIndex(const fs::path& path, const ScanIndex& index) {
+    fs::path tmpPath = temporaryPath(path);
+    bool ok;
+    {
+        std::ofstream out(tmpPath, std::ios::trunc);
+        out << kScanIndexMagic << '\n';
+        for (const auto& [dirPath, dir] : index) {
+            bool representable = dirPath.find('\n') == std::string::npos;
+            for (const auto& name : dir.files) representable = representable && name.find('\n') == std::string::npos;
+            for (const auto& name : dir.subdirs) representable = representable && name.find('\n') == std::string::npos;
+            if (!representable) continue;
+            out << "D " << dir.mtime << ' ' << dirPath << '\n';
+            for (const auto& name : dir.files) out << "F " << name << '\n';
+            for (const auto& name : dir.subdirs) out << "S " << name << '\n';
+        }
+        out.close();
+        ok = !out.fail();
+    }
+    std::error_code ec;
+    if (ok) fs::rename(tmpPath, path, ec);
+    if (!ok || ec) fs::remove(tmpPath, ec);
+}
+
+// Lists one directory. Entry types come from the directory listing itself, so no file is stat'ed.
+ScannedDir listDirectory(const fs::path& dir, bool recursive, const fs::path& skipDir) {
+    ScannedDir result;
+    std::error_code ec;
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        const fs::directory_entry& entry = *it;
+        std::string name = entry.path().filename().string();
+        std::error_code typeEc;
+        if (recursive && entry.is_directory(typeEc) && !entry.is_symlink(typeEc)) {
+            // Hidden directories and our own output (when run from inside the tree) are not reviewed
+            if (name[0] != '.' && entry.path() != skipDir) result.subdirs.push_back(name);
+        } else if (entry.is_regular_file(typeEc) && isImageFile(entry.path())) {
+            result.files.push_back(name);
+        }
+    }
+    return result;
+}
+
+// Character of a relative path at k, with the separator sorting before everything else.
+// Comparing these orders paths component by component like fs::path, so a/b.jpg
+// comes before a/c/x.jpg.
+int pathOrderChar(std::string_view dir, std::string_view name, size_t k) {
+    size_t prefix = dir.empty() ? 0 : dir.size() + 1;
+    char c = (k < dir.size()) ? dir[k] : (k < prefix) ? '/' : name[k - prefix];
+    return (c == '/') ? 0 : (unsigned char)c + 1;
+}
+
+// Catalogue order of two images given as relative directory and file name
+bool pathBefore(std::string_view dirA, std::string_view nameA, std::string_view dirB, std::string_view nameB) {
+    size_t lengthA = (dirA.empty() ? 0 : dirA.size() + 1) + nameA.size();
+    size_t lengthB = (dirB.empty() ? 0 : dirB.size() + 1) + nameB.size();
+    for (size_t k = 0; k < std::min(lengthA, lengthB); ++k) {
+        int ca = pathOrderChar(dirA, nameA, k), cb = pathOrderChar(dirB, nameB, k);
+        if (ca != cb) return ca < cb;
+    }
+    return lengthA < lengthB;
+}
+
+// Lays the scanned directories out in one arena, images sorted by path
+Catalogue buildCatalogue(const fs::path& root, const ScanIndex& scanned) {
+    Catalogue catalogue;
+    std::string rootPath = (root / "").string();
+    size_t bytes = 0, files = 0;
+    for (const auto& [relative, dir] : scanned) {
+        bytes += rootPath.size() + relative.size() + 1;
+        for (const auto& name : dir.files) bytes += name.size();
+        files += dir.files.size();
+    }
+    catalogue.arena.reserve(bytes);
+
+    struct Entry {
+        uint32_t dir, name;
+        uint16_t nameLength;
+    };
+    std::vector<Entry> entries;
+    entries.reserve(files);
+    for (const auto& [relative, dir] : scanned) {
+        if (dir.files.empty()) continue;
+        CatalogueDir entry;
+        entry.path = (uint32_t)catalogue.arena.size();
+        catalogue.arena += rootPath;
+        if (!relative.empty()) catalogue.arena += relative + "/";
+        entry.pathLength = (uint32_t)(catalogue.arena.size() - entry.path);
+        entry.relativeLength = (uint32_t)relative.size();
+        catalogue.dirs.push_back(entry);
+        for (const auto& name : dir.files) {
+            entries.push_back({ (uint32_t)catalogue.dirs.size() - 1, (uint32_t)catalogue.arena.size(), (uint16_t)name.size() });
+            catalogue.arena += name;
+        }
+    }
+
+    const std::string& arena = catalogue.arena;
+    auto relativeDir = [&](uint32_t dir) {
+        const CatalogueDir& d = catalogue.dirs[dir];
+        return std::string_view(arena).substr(d.path + d.pathLength - 1 - d.relativeLength, d.relativeLength);
+    };
+    std::sort(entries.begin(), entries.end(), [&](const Entry& a, const Entry& b) {
+        std::string_view dirA = relativeDir(a.dir), dirB = relativeDir(b.dir);
+        std::string_view nameA = std::string_view(arena).substr(a.name, a.nameLength);
+        std::string_view nameB = std::string_view(arena).substr(b.name, b.nameLength);
+        return pathBefore(dirA, nameA, dirB, nameB);
+    });
+
+    size_t count = entries.size();
+    catalogue.dir.reserve(count);
+    catalogue.name.reserve(count);
+    catalogue.nameLength.reserve(count);
+    for (const Entry& entry : entries) {
+        catalogue.dir.push_back(entry.dir);
+        catalogue.name.push_back(entry.name);
+        catalogue.nameLength.push_back(entry.nameLength);
+    }
+    catalogue.status.assign(count, ImageStatus::Neutral);
+    catalogue.orientation.assign(count, 0);
+    catalogue.loaded.assign(count, 0);
+    catalogue.loading.assign(count, 0);
+    catalogue.failed.assign(count, 0);
+    catalogue.wantFullRes.assign(count, 0);
+    catalogue.generation.assign(count, 0);
+    catalogue.cacheSlot.assign(count, kNoSlot);
+    catalogue.hash.assign(count, 0);
+    catalogue.sharpness.assign(count, 0.0f);
+    catalogue.hashed.assign(count, 0);
+    catalogue.sameAsPrevious.assign(count, 0);
+    catalogue.thumbChecked.assign(count, 0);
+    return catalogue;
+}
+
+// Full path of an image, for reading and as the symlink target
+std::string imagePath(size_t index) {
+    const CatalogueDir& dir = g_catalogue.dirs[g_catalogue.dir[index]];
+    std::string path(g_catalogue.arena, dir.path, dir.pathLength);
+    path.append(g_catalogue.arena, g_catalogue.name[index], g_catalogue.nameLength[index]);
+    return path;
+}
+
+// Name of the image's link in the chosen directory. Images in subdirectories are linked
+// as dir%2Fsub%2Fname.jpg so the chosen directory stays flat. '%' itself is escaped as %25,
+// which keeps the mapping reversible: two different relative paths never share a link name,
+// and names at the top level, which have neither character, link under their own name.
+std::string linkName(size_t index) {
+    const CatalogueDir& dir = g_catalogue.dirs[g_catalogue.dir[index]];
+    std::string relative(g_catalogue.arena, dir.path + dir.pathLength - 1 - dir.relativeLength, dir.relativeLength);
+    if (!relative.empty()) relative += '/';
+    relative.append(g_catalogue.arena, g_catalogue.name[index], g_catalogue.nameLength[index]);
+
+    std::string name;
+    name.reserve(relative.size());
+    for (char ch : relative) {
+        if (ch == '/') name += "%2F";
+        else if (ch == '%') name += "%25";
+        else name += ch;
+    }
+    return name;
+}
+
+// Finds the images under root, listing directories in parallel. Directories whose mtime
+// matches the cached index reuse its listing, so a re-open only stats each directory once.
+Catalogue scanDirectory(const fs::path& root, bool recursive) {
+    bool useIndex = g_useScanCache && !g_diskCacheDir.empty();
+    fs::path indexPath = useIndex ? scanIndexPath(root, recursive) : fs::path();
+    ScanIndex cached = useIndex ? loadScanIndex(indexPath) : ScanIndex();
+
+    ScanIndex scanned;
+    std::vector<std::string> pending = { "" };
+    size_t busy = 0, reused = 0;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    auto worker = [&]() {
+        setTraceThreadName("scan");
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [&] { return !pending.empty() || busy == 0; });
+            if (pending.empty()) return;
+            std::string relative = std::move(pending.back());
+            pending.pop_back();
+            busy++;
+            lock.unlock();
+
+            fs::path dir = relative.empty() ? root : root / relative;
+            SourceStamp stamp;
+            bool stamped = statSource(dir.string(), stamp);
+            auto hit = cached.find(relative);
+            bool fresh = stamped && hit != cached.end() && hit->second.mtime == stamp.mtime;
+            ScannedDir contents = fresh ? hit->second : listDirectory(dir, recursive, g_chosenDir);
+            contents.mtime = stamped ? stamp.mtime : 0;
+
+            lock.lock();
+            if (fresh) reused++;
+            for (const auto& sub : contents.subdirs) {
+                pending.push_back(relative.empty() ? sub : relative + "/" + sub);
+            }
+            scanned[relative] = std::move(contents);
+            busy--;
+            cv.notify_all();
+        }
+    };
+
+    // A single directory gains nothing from extra threads
+    unsigned threads = recursive ? std::max(2u, std::min(8u, std::thread::hardware_concurrency())) : 1;
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threads; ++i) workers.emplace_back(worker);
+    for (auto& t : workers) t.join();
+
+    if (useIndex) {
+        if (reused) std::cout << "Reused " << reused << " of " << scanned.size() << " directories from the scan index." << std::endl;
+        if (reused != scanned.size() || scanned.size() != cached.size()) storeScanIndex(indexPath, scanned);
+    }
+    return buildCatalogue(root, scanned);
+}
+
+// Names in the chosen directory, read with a single listing instead of one lookup per image
+std::unordered_set<std::string> listChosen(const fs::path& chosenDir) {
+    std::unordered_set<std::string> names;
+    std::error_code ec;
+    for (fs::directory_iterator it(chosenDir, ec), end; !ec && it != end; it.increment(ec)) {
+        names.insert(it->path().filename().string());
+    }
+    return names;
+}
+
+// ---------------------------------------------------------
+// Decode Cache
+// ---------------------------------------------------------
+
+size_t imageBytes(const RawImage& img) {
+    size_t bytes = img.thumbData ? (size_t)img.thumbWidth * img.thumbHeight * 4 : 0;
+    if (img.data) bytes += (img.layout == PixelLayout::I420) ? i420Bytes(img.width, img.height) : (size_t)img.width * img.height * 4;
+    for (const auto& mip : img.mips) bytes += (size_t)mip.width * mip.height * 4;
+    return bytes;
+}
+
+// Wakes the main loop to pick up new pixels. Safe to call from any thread.
+void wakeMainLoop() {
+    if (g_wakeEvent == (Uint32)-1 || g_wakePosted.exchange(true)) return;
+    SDL_Event event = {};
+    event.type = g_wakeEvent;
+    SDL_PushEvent(&event);
+}
+
+// Decoded entry of an image, nullptr while nothing of it is resident. Caller must hold g_cacheMutex.
+RawImage* decodedImage(size_t index) {
+    uint32_t slot = g_catalogue.cacheSlot[index];
+    return (slot == kNoSlot) ? nullptr : &g_decoded[slot];
+}
+
+// Decoded entry of an image, taking a free one if it has none yet. Caller must hold g_cacheMutex.
+RawImage& acquireDecoded(size_t index) {
+    if (RawImage* img = decodedImage(index)) return *img;
+    uint32_t slot;
+    if (!g_freeDecoded.empty()) {
+        slot = g_freeDecoded.back();
+        g_freeDecoded.pop_back();
+    } else {
+        slot = (uint32_t)g_decoded.size();
+        g_decoded.emplace_back();
+    }
+    g_catalogue.cacheSlot[index] = slot;
+    g_decoded[slot].owner = index;
+    return g_decoded[slot];
+}
+
+// Hands the entry of an image back once it holds no pixels. Caller must hold g_cacheMutex.
+void releaseDecoded(size_t index) {
+    RawImage* img = decodedImage(index);
+    if (!img || img->data || img->thumbData) return;
+    *img = RawImage();
+    g_freeDecoded.push_back(g_catalogue.cacheSlot[index]);
+    g_catalogue.cacheSlot[index] = kNoSlot;
+}
+
+// Whether a scrubbing loader should read the image's EXIF thumbnail: nothing to show yet
+// and the file wasn't checked before. Caller must hold g_cacheMutex.
+bool needsThumbnail(size_t index) {
+    const Catalogue& c = g_catalogue;
+    if (c.loading[index] || c.failed[index] || c.loaded[index] || c.thumbChecked[index]) return false;
+    const RawImage* img = decodedImage(index);
+    return !img || !img->thumbData;
+}
+
+// Whether a loader should (re)decode the image: not resident yet, or resident
+// at screen size while a zoomed view wants full resolution.
+bool needsDecode(size_t index) {
+    const Catalogue& c = g_catalogue;
+    if (c.loading[index] || c.failed[index]) return false;
+    return !c.loaded[index] || (c.wantFullRes[index] && !decodedImage(index)->fullRes);
+}
+
+// Pixels of a mip level, 0 being the decode itself. Caller must hold g_cacheMutex.
+const SharedPixels& levelPixels(const RawImage& img, int level, int& width, int& height) {
+    if (level <= 0 || img.mips.empty()) {
+        width = img.width;
+        height = img.height;
+        return img.data;
+    }
+    const MipLevel& mip = img.mips[std::min(level, (int)img.mips.size()) - 1];
+    width = mip.width;
+    height = mip.height;
+    return mip.data;
+}
+
+// Smallest mip level that still has at least one pixel per screen pixel at the given zoom.
+// Fitting the window (zoom 0) uses the smallest level. Caller must hold g_cacheMutex.
+int mipLevelFor(const RawImage& img, float zoomScale) {
+    int levels = (int)img.mips.size();
+    if (zoomScale <= 0.0f) return levels;
+    int level = 0;
+    while (level < levels && zoomScale * (2 << level) <= 1.0f) ++level;
+    return level;
+}
+
+// Distance of an image from the cache center along the direction of travel.
+// Steps behind are weighted by the window shape, so eviction drops images the user
+// is moving away from first and prefetch favours the images coming up next.
+size_t cacheDistance(size_t index) {
+    size_t n = g_catalogue.size();
+    size_t forward = (index + n - g_cacheCenter) % n;
+    size_t backward = (g_cacheCenter + n - index) % n;
+    size_t ahead = (g_cacheDirection >= 0) ? forward : backward;
+    size_t behind = (g_cacheDirection >= 0) ? backward : forward;
+    return std::min(ahead * (g_prefetchBehind + 1), behind * (g_prefetchAhead + 1));
+}
+
+bool inPrefetchWindow(size_t index) {
+    // The headless batch wants every image once
+    if (g_headless) return true;
+    // The contact sheet wants its page and the next one instead
+    if (g_cacheGridFirst != SIZE_MAX) return index >= g_cacheGridFirst && index - g_cacheGridFirst < 2 * kGridPage;
+    size_t n = g_catalogue.size();
+    size_t forward = (index + n - g_cacheCenter) % n;
+    size_t backward = (g_cacheCenter + n - index) % n;
+    size_t ahead = (g_cacheDirection >= 0) ? forward : backward;
+    size_t behind = (g_cacheDirection >= 0) ? backward : forward;
+    return ahead <= (size_t)g_prefetchAhead || behind <= (size_t)g_prefetchBehind;
+}
+
+// Hands the planes of an evicted decode to the packer thread. Caller must hold g_cacheMutex.
+void queuePack(size_t index, RawImage& img) {
+    {
+        std::lock_guard<std::mutex> lock(g_packer.mutex);
+        if (g_packer.pending.size() >= kMaxPendingPacks) g_packer.pending.pop_front();
+        g_packer.pending.push_back({ index, g_catalogueEpoch, std::move(img.data), img.width, img.height, img.fullWidth, img.fullHeight });
+    }
+    g_packer.cv.notify_one();
+}
+
+// Frees the decoded pixels of an image. Caller must hold g_cacheMutex.
+void evictImage(size_t index) {
+    RawImage* img = decodedImage(index);
+    if (!img || (!g_catalogue.loaded[index] && !img->thumbData)) return;
+    g_cacheBytes -= imageBytes(*img);
+    if (g_catalogue.loaded[index]) g_cacheLoaded--;
+    // Screen sized decodes move down to the packed tier unless it already holds them
+    if (g_catalogue.loaded[index] && img->layout == PixelLayout::I420 && g_packedBudgetBytes && !g_packed.count(index)) {
+        queuePack(index, *img);
+    }
+    img->data.reset();
+    img->thumbData.reset();
+    img->mips.clear();
+    img->fullRes = false;
+    g_catalogue.loaded[index] = false;
+    g_catalogue.thumbChecked[index] = false; // A thumbnail can be read again
+    g_catalogue.generation[index]++;
+    releaseDecoded(index);
+}
+
+// Evicts the images furthest from the cache center until the budget is met.
+// The center image is never evicted. Caller must hold g_cacheMutex.
+void trimCache() {
+    while (g_cacheBytes > g_cacheBudgetBytes) {
+        // Only the decoded entries are visited, not the whole catalogue
+        size_t victim = SIZE_MAX, victimDistance = 0;
+        for (const RawImage& img : g_decoded) {
+            size_t i = img.owner;
+            if (i == SIZE_MAX || (!g_catalogue.loaded[i] && !img.thumbData) || i == g_cacheCenter) continue;
+            size_t d = cacheDistance(i);
+            if (victim == SIZE_MAX || d > victimDistance) {
+                victim = i;
+                victimDistance = d;
+            }
+        }
+        if (victim == SIZE_MAX) break;
+        evictImage(victim);
+    }
+}
+
+// Drops the packed images furthest from the cache center until the packed budget is met.
+// Caller must hold g_cacheMutex.
+void trimPacked() {
+    while (g_packedBytes > g_packedBudgetBytes) {
+        auto victim = g_packed.end();
+        size_t victimDistance = 0;
+        for (auto it = g_packed.begin(); it != g_packed.end(); ++it) {
+            size_t d = cacheDistance(it->first);
+            if (victim == g_packed.end() || d > victimDistance) {
+                victim = it;
+                victimDistance = d;
+            }
+        }
+        g_packedBytes -= victim->second->bytes.size();
+        g_packed.erase(victim);
+    }
+}
+
+void packWorker() {
+    setTraceThreadName("packer");
+    std::unique_lock<std::mutex> lock(g_packer.mutex);
+    while (true) {
+        g_packer.cv.wait(lock, [] { return g_packer.stopping || !g_packer.pending.empty(); });
+        if (g_packer.stopping) return;
+        PendingPack job = std::move(g_packer.pending.front());
+        g_packer.pending.pop_front();
+        lock.unlock();
+
+        TraceScope scope("packImage");
+        auto packStart = TraceClock::now();
+        auto packed = std::make_shared<PackedImage>();
+        packed->bytes = packI420(job.planes.get(), job.width, job.height);
+        packed->width = job.width;
+        packed->height = job.height;
+        packed->fullWidth = job.fullWidth;
+        packed->fullHeight = job.fullHeight;
+        job.planes.reset();
+        recordStage(BenchStage::Pack, packStart);
+        {
+            std::lock_guard<std::mutex> cacheLock(g_cacheMutex);
+            if (job.epoch == g_catalogueEpoch && !g_packed.count(job.index)) {
+                g_packedBytes += packed->bytes.size();
+                g_packed.emplace(job.index, std::move(packed));
+                trimPacked();
+            }
+        }
+        lock.lock();
+    }
+}
+
+void startPacker() {
+    g_packer.thread = std::thread(packWorker);
+}
+
+// Evictions still waiting are dropped, the tier doesn't outlive the process
+void stopPacker() {
+    {
+        std::lock_guard<std::mutex> lock(g_packer.mutex);
+        g_packer.stopping = true;
+    }
+    g_packer.cv.notify_all();
+    if (g_packer.thread.joinable()) g_packer.thread.join();
+    g_packer.pending.clear();
+}
+
+// Joins a newly hashed image to the bursts of its neighbours. Caller must hold g_cacheMutex.
+void linkBurstNeighbours(size_t index) {
+    Catalogue& c = g_catalogue;
+    auto similar = [&](size_t a, size_t b) {
+        return c.hashed[a] && c.hashed[b] && std::bitset<64>(c.hash[a] ^ c.hash[b]).count() <= kBurstDistance;
+    };
+    if (index > 0) c.sameAsPrevious[index] = similar(index - 1, index);
+    if (index + 1 < c.size()) c.sameAsPrevious[index + 1] = similar(index, index + 1);
+}
+
+// Publishes the embedded EXIF thumbnail so something can be shown before the real decode lands.
+// Returns true if the thumbnail already covers the target size and can stand in for the full decode.
+bool loadExifThumbnail(size_t index, const MappedFile& file, const ExifInfo& exif, int orientation) {
+    if (!exif.thumbnailLength) return false;
+
+    int fullWidth = 0, fullHeight = 0, channels = 0;
+    if (!stbi_info_from_memory(file.data(), (int)file.size(), &fullWidth, &fullHeight, &channels)) return false;
+
+    int width = 0, height = 0;
+    PixelBuffer thumb(stbi_load_from_memory(file.data() + exif.thumbnailOffset, (int)exif.thumbnailLength,
+                                            &width, &height, &channels, 4));
+    if (!thumb) return false;
+
+    // Thumbnails with a different aspect ratio are letterboxed, only use them as a preview
+    double fullAspect = (double)fullWidth / fullHeight;
+    double thumbAspect = (double)width / height;
+    SDL_Rect fitted = fitToTarget(fullWidth, fullHeight, orientation);
+    bool sufficient = std::abs(fullAspect - thumbAspect) < 0.01 * fullAspect && width >= fitted.w && height >= fitted.h;
+
+    {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        RawImage& img = acquireDecoded(index);
+        g_cacheBytes -= imageBytes(img);
+        img.thumbData = std::move(thumb);
+        img.thumbWidth = width;
+        img.thumbHeight = height;
+        img.fullWidth = fullWidth;
+        img.fullHeight = fullHeight;
+        g_catalogue.generation[index]++;
+        g_cacheBytes += imageBytes(img);
+    }
+    g_cacheCv.notify_all();
+    wakeMainLoop();
+    return sufficient;
+}
+
+double movingAverage(double average, double sample) {
+    return average > 0 ? average + kThroughputWeight * (sample - average) : sample;
+}
+
+// Waits for a read slot, the current image gets one right away
+void acquireRead(bool current) {
+    std::unique_lock<std::mutex> lock(g_readGate.mutex);
+    if (!current) g_readGate.cv.wait(lock, [] { return g_readGate.inFlight < g_readGate.limit; });
+    g_readGate.inFlight++;
+}
+
+// Frees a read slot and folds the read into the measurements. Reads running alongside share the
+// bandwidth, so each one counts for its share of the total.
+void releaseRead(size_t bytes, TraceClock::time_point start) {
+    double seconds = std::chrono::duration<double>(TraceClock::now() - start).count();
+    {
+        std::lock_guard<std::mutex> lock(g_readGate.mutex);
+        if (bytes && seconds > 0) {
+            g_readGate.bandwidth = movingAverage(g_readGate.bandwidth, bytes * g_readGate.inFlight / seconds);
+            g_readGate.fileBytes = movingAverage(g_readGate.fileBytes, (double)bytes);
+            int fits = (int)(kReadLatencyTarget * g_readGate.bandwidth / g_readGate.fileBytes);
+            g_readGate.limit = std::max(1, std::min(fits, (int)g_decodePool.workers.size()));
+        }
+        g_readGate.inFlight--;
+    }
+    g_readGate.cv.notify_all();
+}
+
+void recordDecodeTime(TraceClock::time_point start) {
+    double seconds = std::chrono::duration<double>(TraceClock::now() - start).count();
+    std::lock_guard<std::mutex> lock(g_readGate.mutex);
+    g_readGate.decodeSeconds = movingAverage(g_readGate.decodeSeconds, seconds);
+}
+
+// Whether the storage has room for a readahead hint, hints are reads the gate doesn't see
+bool readSlotFree() {
+    std::lock_guard<std::mutex> lock(g_readGate.mutex);
+    return g_readGate.inFlight < g_readGate.limit;
+}
+
+// Images ahead of the current one worth decoding: as many as reading and decoding get through
+// in kPrefetchHorizon, between 2 and --prefetch. Slow media get a short window that doesn't
+// tie them up with images the user may never reach.
+int prefetchDepth() {
+    std::lock_guard<std::mutex> lock(g_readGate.mutex);
+    if (g_readGate.bandwidth <= 0 || g_readGate.decodeSeconds <= 0) return g_prefetchAhead;
+    double readRate = g_readGate.bandwidth / g_readGate.fileBytes;
+    double decodeRate = g_decodePool.workers.size() / g_readGate.decodeSeconds;
+    int depth = (int)std::ceil(std::min(readRate, decodeRate) * kPrefetchHorizon);
+    return std::max(std::min(2, g_prefetchAhead), std::min(depth, g_prefetchAhead));
+}
+
+// Loads a single image into raw memory (CPU side)
+// This is designed to be thread-safe for parallel loading
+// JPEGs are decoded at screen resolution unless fullRes is set.
+void loadImageIntoMemory(size_t index, bool fullRes) {
+    TraceScope scope("loadImageIntoMemory");
+    std::string path = imagePath(index);
+    int width = 0, height = 0, channels = 4;
+    int fullWidth = 0, fullHeight = 0;
+    int orientation = 1;
+    SharedPixels data;
+    PixelLayout layout = PixelLayout::Rgba;
+    ExifInfo exif;
+
+    // An earlier decode still in the packed tier, if the window wants the same size
+    std::shared_ptr<const PackedImage> packed;
+    if (!fullRes) {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        auto found = g_packed.find(index);
+        if (found != g_packed.end()) packed = found->second;
+        orientation = g_catalogue.orientation[index] ? g_catalogue.orientation[index] : 1;
+    }
+    bool fromPacked = false;
+    if (packed) {
+        SDL_Rect fitted = fitToTarget(packed->fullWidth, packed->fullHeight, orientation);
+        if (packed->width == fitted.w && packed->height == fitted.h) {
+            auto unpackStart = TraceClock::now();
+            data = unpackI420(packed->bytes, packed->width, packed->height);
+            if (data) {
+                recordStage(BenchStage::Unpack, unpackStart);
+                width = packed->width;
+                height = packed->height;
+                fullWidth = packed->fullWidth;
+                fullHeight = packed->fullHeight;
+                layout = PixelLayout::I420;
+                fromPacked = true;
+            }
+        }
+    }
+
+    // A preview from an earlier run stands in for the screen sized decode if it still covers the window
+    SourceStamp stamp;
+    bool cacheable = !fromPacked && !fullRes && g_usePreviewCache && !g_diskCacheDir.empty() && statSource(path, stamp);
+    bool fromPreview = false;
+    PreviewHeader preview = {};
+    if (cacheable) {
+        auto previewStart = TraceClock::now();
+        data = loadCachedPreview(path, stamp, preview);
+        if (data) {
+            recordStage(BenchStage::Preview, previewStart);
+            {
+                std::lock_guard<std::mutex> lock(g_cacheMutex);
+                uint8_t& stored = g_catalogue.orientation[index];
+                if (!stored) stored = (uint8_t)preview.orientation;
+                orientation = stored;
+            }
+            SDL_Rect fitted = fitToTarget(preview.fullWidth, preview.fullHeight, orientation);
+            if (preview.width >= fitted.w && preview.height >= fitted.h) {
+                width = preview.width;
+                height = preview.height;
+                fullWidth = preview.fullWidth;
+                fullHeight = preview.fullHeight;
+                fromPreview = true;
+            } else {
+                data.reset();
+            }
+        }
+    }
+
+    MappedFile file;
+    bool opened = false;
+    auto readStart = TraceClock::now();
+    if (!data) {
+        bool current;
+        {
+            std::lock_guard<std::mutex> lock(g_cacheMutex);
+            current = index == g_cacheCenter;
+        }
+        acquireRead(current);
+        readStart = TraceClock::now();
+        opened = openFile(path, file);
+        releaseRead(opened ? file.size() : 0, readStart);
+    }
+    auto decodeStart = TraceClock::now();
+    bool jpeg = false;
+    if (opened) {
+        recordStage(BenchStage::Read, readStart);
+        jpeg = isJpegData(file.data(), file.size());
+        if (jpeg) parseExif(file.data(), file.size(), exif);
+
+        // The pixels stay as stored, orientation is applied when drawing.
+        // Rotations the user already made take precedence over the EXIF tag.
+        {
+            std::lock_guard<std::mutex> lock(g_cacheMutex);
+            uint8_t& stored = g_catalogue.orientation[index];
+            if (!stored) stored = (uint8_t)exif.orientation;
+            orientation = stored;
+        }
+
+        if (jpeg && !fullRes && loadExifThumbnail(index, file, exif, orientation)) {
+            // The embedded thumbnail is big enough, promote it to the decoded image
+            std::lock_guard<std::mutex> lock(g_cacheMutex);
+            RawImage& img = acquireDecoded(index);
+            data = std::move(img.thumbData);
+            width = img.thumbWidth;
+            height = img.thumbHeight;
+            fullWidth = img.fullWidth;
+            fullHeight = img.fullHeight;
+            g_cacheBytes -= (size_t)width * height * 4;
+        }
+
+        if (!data) {
+            // Portrait shots are drawn rotated, so fit them against the rotated target
+            int targetWidth = fullRes ? 0 : g_targetWidth.load();
+            int targetHeight = fullRes ? 0 : g_targetHeight.load();
+            if (orientationTransform(orientation).quarterTurns % 2) std::swap(targetWidth, targetHeight);
+            DecodedSize decoded;
+            data = decodeImage(file.data(), file.size(), targetWidth, targetHeight, decoded);
+            width = decoded.width;
+            height = decoded.height;
+            fullWidth = decoded.fullWidth;
+            fullHeight = decoded.fullHeight;
+        }
+        if (data) recordStage(BenchStage::Decode, decodeStart);
+    }
+    
+    // Screen sized decodes are shrunk to exactly the drawn size, full resolution
+    // decodes get a mip chain down to it for the zoom levels in between
+    std::vector<MipLevel> mips;
+    ImageSignature signature;
+    bool computedSignature = false;
+    if (data) {
+        SDL_Rect fitted = fitToTarget(fullWidth, fullHeight, orientation);
+        auto resizeStart = TraceClock::now();
+        if (!fullRes && (width > fitted.w || height > fitted.h)) {
+            PixelBuffer resized = resampleImage(data.get(), width, height, fitted.w, fitted.h, g_resampleFilter);
+            if (resized) {
+                data = std::move(resized);
+                width = fitted.w;
+                height = fitted.h;
+            }
+            recordStage(BenchStage::Resample, resizeStart);
+        } else if (fullRes) {
+            const unsigned char* source = data.get();
+            int levelWidth = width, levelHeight = height;
+            while (levelWidth / 2 >= fitted.w && levelHeight / 2 >= fitted.h && levelWidth >= 2 && levelHeight >= 2) {
+                PixelBuffer half = halveImage(source, levelWidth, levelHeight);
+                if (!half) break;
+                levelWidth /= 2;
+                levelHeight /= 2;
+                source = half.get();
+                mips.push_back({ std::move(half), levelWidth, levelHeight });
+            }
+            recordStage(BenchStage::Mips, resizeStart);
+        }
+        if (opened) recordDecodeTime(decodeStart);
+
+        // Hash the screen sized level once, the burst groups only need it the first time
+        bool hashed;
+        {
+            std::lock_guard<std::mutex> lock(g_cacheMutex);
+            hashed = g_catalogue.hashed[index];
+            signature.hash = g_catalogue.hash[index];
+            signature.sharpness = g_catalogue.sharpness[index];
+        }
+        if (!hashed && fromPreview && preview.hashed) {
+            // Hashed when the preview was written
+            signature.hash = preview.hash;
+            signature.sharpness = preview.sharpness;
+            computedSignature = true;
+        } else if (!hashed && layout == PixelLayout::Rgba) {
+            auto hashStart = TraceClock::now();
+            const MipLevel* smallest = mips.empty() ? nullptr : &mips.back();
+            signature = smallest ? imageSignature(smallest->data.get(), smallest->width, smallest->height)
+                                 : imageSignature(data.get(), width, height);
+            computedSignature = true;
+            recordStage(BenchStage::Hash, hashStart);
+        }
+        if (cacheable && !fromPreview) {
+            bool haveSignature = hashed || computedSignature;
+            storeCachedPreview(path, stamp, data.get(), width, height, fullWidth, fullHeight, exif.orientation, haveSignature ? &signature : nullptr);
+        }
+
+        // Screen sized decodes stay resident as YUV 4:2:0, 1.5 bytes per pixel instead of 4,
+        // and the GPU converts them back when drawing. Full resolution decodes stay RGBA for the
+        // tiles, and so do images with transparency. JPEGs have none, others are checked.
+        if (!fullRes && g_planarDecodes && layout == PixelLayout::Rgba && (jpeg || isOpaque(data.get(), width, height))) {
+            auto planarStart = TraceClock::now();
+            PixelBuffer planar = rgbaToI420(data.get(), width, height);
+            if (planar) {
+                data = std::move(planar);
+                layout = PixelLayout::I420;
+            }
+            recordStage(BenchStage::Planar, planarStart);
+        }
+    } else {
+        fprintf(stderr, "Failed to load: %s\n", path.c_str());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        Catalogue& c = g_catalogue;
+        if (data) {
+            // Replaces a lower resolution decode when upgrading to full resolution
+            RawImage& img = acquireDecoded(index);
+            g_cacheBytes -= imageBytes(img);
+            if (!c.loaded[index]) g_cacheLoaded++;
+            img.data = std::move(data);
+            img.layout = layout;
+            img.mips = std::move(mips);
+            img.width = width;
+            img.height = height;
+            img.channels = channels;
+            img.fullWidth = fullWidth;
+            img.fullHeight = fullHeight;
+            img.fullRes = width == fullWidth && height == fullHeight;
+            c.loaded[index] = true;
+            c.generation[index]++;
+            g_cacheBytes += imageBytes(img);
+            recordDecoded(fullWidth, fullHeight);
+            if (computedSignature && !c.hashed[index]) {
+                c.hash[index] = signature.hash;
+                c.sharpness[index] = signature.sharpness;
+                c.hashed[index] = true;
+                linkBurstNeighbours(index);
+            }
+        } else if (!c.loaded[index]) {
+            c.failed[index] = true;
+            releaseDecoded(index);
+        }
+        c.loading[index] = false;
+        trimCache();
+    }
+    g_cacheCv.notify_all();
+    wakeMainLoop();
+}
+
+// Hints the file a decode of an image will read: its cached preview if there is one, else the source
+void hintImageReadahead(size_t index) {
+    std::string path = imagePath(index);
+    SourceStamp stamp;
+    if (g_usePreviewCache && !g_diskCacheDir.empty() && statSource(path, stamp)) {
+        fs::path preview = previewPath(path, stamp);
+        std::error_code ec;
+        if (fs::exists(preview, ec)) {
+            hintReadahead(preview.string());
+            return;
+        }
+    }
+    hintReadahead(path);
+}
+
+// EXIF data sits in the first 64 KB, the frame header with the full size soon after
+const size_t kThumbnailPrefix = 192 * 1024;
+
+// Reads just the embedded EXIF thumbnail from the start of the file, the cheap stand-in
+// shown while scrubbing. The real decode waits until navigation settles. With decodeFallback
+// a file without a usable thumbnail gets a screen sized decode instead.
+void loadThumbnailOnly(size_t index, bool decodeFallback) {
+    TraceScope scope("loadThumbnailOnly");
+    MappedFile file;
+    if (openFile(imagePath(index), file, kThumbnailPrefix) && isJpegData(file.data(), file.size())) {
+        ExifInfo exif;
+        parseExif(file.data(), file.size(), exif);
+        int orientation;
+        {
+            std::lock_guard<std::mutex> lock(g_cacheMutex);
+            uint8_t& stored = g_catalogue.orientation[index];
+            if (!stored) stored = (uint8_t)exif.orientation;
+            orientation = stored;
+        }
+        loadExifThumbnail(index, file, exif, orientation);
+    }
+
+    if (decodeFallback) {
+        bool found;
+        {
+            std::lock_guard<std::mutex> lock(g_cacheMutex);
+            const RawImage* img = decodedImage(index);
+            found = img && img->thumbData;
+        }
+        if (!found) {
+            loadImageIntoMemory(index, false); // Clears the loading flag
+            return;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+    g_catalogue.loading[index] = false;
+    g_catalogue.thumbChecked[index] = true;
+    releaseDecoded(index);
+    trimCache();
+}
+
+// The image's orientation, read from its EXIF header now if no load has stored it yet
+int resolveOrientation(size_t index) {
+    {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        if (g_catalogue.orientation[index]) return g_catalogue.orientation[index];
+    }
+    MappedFile file;
+    ExifInfo exif;
+    if (openFile(imagePath(index), file, kThumbnailPrefix) && isJpegData(file.data(), file.size())) {
+        parseExif(file.data(), file.size(), exif);
+    }
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+    uint8_t& stored = g_catalogue.orientation[index];
+    if (!stored) stored = (uint8_t)exif.orientation;
+    return stored;
+}
+
+// Replaces the pending decode jobs. Jobs that are no longer wanted are dropped,
+// the rest are reordered by their new priority.
+void scheduleDecodes(const std::vector<DecodeJob>& jobs) {
+    {
+        std::lock_guard<std::mutex> lock(g_decodePool.mutex);
+        g_decodePool.queue = std::priority_queue<DecodeJob>(jobs.begin(), jobs.end());
+    }
+    g_decodePool.cv.notify_all();
+}
+
+// Whether a worker on this kind of core should take the job at the front of the queue. The
+// current image (priority 0) is left to an idle performance core and the prefetch to an idle
+// efficiency core, either kind takes anything the other kind has no idle worker for.
+bool takesFrontJob(bool efficiency) {
+    if (g_decodePool.queue.empty()) return false;
+    bool current = g_decodePool.queue.top().priority == 0;
+    if (efficiency) return !current || g_decodePool.idlePerformance == 0;
+    return current || g_decodePool.idleEfficiency == 0;
+}
+
+void decodeWorker(DecodeCpu cpu) {
+    setTraceThreadName(cpu.efficiency ? "decode (efficiency core)" : "decode");
+    pinThread(cpu);
+    unsigned& idle = cpu.efficiency ? g_decodePool.idleEfficiency : g_decodePool.idlePerformance;
+    for (;;) {
+        DecodeJob job;
+        size_t next;
+        {
+            std::unique_lock<std::mutex> lock(g_decodePool.mutex);
+            idle++;
+            g_decodePool.cv.wait(lock, [&] { return g_decodePool.stopping || takesFrontJob(cpu.efficiency); });
+            idle--;
+            if (g_decodePool.stopping) return;
+            job = g_decodePool.queue.top();
+            g_decodePool.queue.pop();
+            next = g_decodePool.queue.empty() ? SIZE_MAX : g_decodePool.queue.top().index;
+        }
+        // One fewer idle worker of this kind, the next job may now fall to the other kind
+        if (next != SIZE_MAX) g_decodePool.cv.notify_all();
+
+        // Get the kernel reading the next file while this one decodes
+        if (next != SIZE_MAX && readSlotFree()) hintImageReadahead(next);
+
+        bool fullRes;
+        {
+            // Skip jobs that were already handled or drifted out of the window
+            std::lock_guard<std::mutex> lock(g_cacheMutex);
+            bool needed = (job.kind == DecodeKind::Image) ? needsDecode(job.index) : needsThumbnail(job.index);
+            if (!needed || !inPrefetchWindow(job.index)) continue;
+            g_catalogue.loading[job.index] = true;
+            fullRes = g_catalogue.wantFullRes[job.index];
+        }
+        if (job.kind == DecodeKind::Image) {
+            loadImageIntoMemory(job.index, fullRes);
+        } else {
+            loadThumbnailOnly(job.index, job.kind == DecodeKind::ThumbnailOrImage);
+        }
+    }
+}
+
+void startDecodePool() {
+    std::vector<DecodeCpu> cpus;
+    if (g_pinDecodes) cpus = decodeCpus();
+    if (cpus.empty()) cpus.resize(std::max(1u, std::thread::hardware_concurrency()));
+
+    size_t efficiency = std::count_if(cpus.begin(), cpus.end(), [](const DecodeCpu& cpu) { return cpu.efficiency; });
+    if (cpus.front().cpu >= 0) {
+        std::cout << "Decode workers pinned: " << cpus.size();
+        if (efficiency) std::cout << ", " << efficiency << " of them on efficiency cores";
+        std::cout << "." << std::endl;
+    }
+    for (const DecodeCpu& cpu : cpus) {
+        g_decodePool.workers.emplace_back(decodeWorker, cpu);
+    }
+}
+
+// Waits for in-flight decodes to finish and discards the queued ones
+void stopDecodePool() {
+    {
+        std::lock_guard<std::mutex> lock(g_decodePool.mutex);
+        g_decodePool.stopping = true;
+    }
+    g_decodePool.cv.notify_all();
+    for (auto& worker : g_decodePool.workers) worker.join();
+    g_decodePool.workers.clear();
+}
+
+// True once the queue is drained and every worker waits for more
+bool decodePoolIdle() {
+    std::lock_guard<std::mutex> lock(g_decodePool.mutex);
+    return g_decodePool.queue.empty() && g_decodePool.idlePerformance + g_decodePool.idleEfficiency == g_decodePool.workers.size();
+}
+
+// Recenters the decode window on g_currentIndex, evicts what no longer fits
+// and queues decodes for the missing images, nearest first.
+void updatePrefetchWindow() {
+    std::vector<DecodeJob> jobs;
+    int ahead = prefetchDepth();
+    {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        Catalogue& c = g_catalogue;
+        c.wantFullRes[g_cacheCenter] = false;
+        g_cacheCenter = g_currentIndex;
+        g_cacheDirection = g_navDirection;
+        g_cacheGridFirst = g_gridMode ? g_gridFirst : SIZE_MAX;
+        // Zoomed in further than the resident copy can show, decode at full resolution
+        const RawImage* center = decodedImage(g_cacheCenter);
+        c.wantFullRes[g_cacheCenter] = !g_scrubbing && !g_gridMode && g_zoomScale > 0.0f && (!c.loaded[g_cacheCenter] || g_zoomScale * center->fullWidth > center->width);
+        trimCache();
+
+        if (g_gridMode) {
+            // Thumbnails for the page, then the page after it
+            for (size_t i = g_gridFirst; i < c.size() && i - g_gridFirst < 2 * kGridPage; ++i) {
+                const RawImage* img = decodedImage(i);
+                if (needsThumbnail(i)) {
+                    jobs.push_back({ i, i - g_gridFirst, DecodeKind::ThumbnailOrImage });
+                } else if (c.thumbChecked[i] && !(img && img->thumbData) && needsDecode(i)) {
+                    jobs.push_back({ i, i - g_gridFirst }); // Checked while scrubbing, has no thumbnail
+                }
+            }
+        } else if (g_scrubbing) {
+            // Scrubbing past images: drop the queued decodes and only read thumbnails ahead
+            long long n = (long long)c.size();
+            for (int step = 0; step <= std::min(kScrubLookahead, g_prefetchAhead); ++step) {
+                long long offset = (g_cacheDirection >= 0) ? step : -step;
+                size_t i = (size_t)((((long long)g_cacheCenter + offset) % n + n) % n);
+                if (needsThumbnail(i)) jobs.push_back({ i, (size_t)step, DecodeKind::Thumbnail });
+            }
+        }
+
+        // Walk the window itself rather than the whole catalogue
+        long long n = (long long)c.size();
+        std::vector<size_t> wanted;
+        for (int step = -g_prefetchBehind; step <= ahead; ++step) {
+            long long offset = (g_cacheDirection >= 0) ? step : -step;
+            size_t i = (size_t)((((long long)g_cacheCenter + offset) % n + n) % n);
+            if (std::find(wanted.begin(), wanted.end(), i) == wanted.end()) wanted.push_back(i);
+        }
+        std::sort(wanted.begin(), wanted.end(), [](size_t a, size_t b) { return cacheDistance(a) < cacheDistance(b); });
+        if (g_scrubbing || g_gridMode) wanted.clear();
+
+        // Shrink the window to what the budget can hold, estimating unknown sizes from the resident average
+        size_t averageBytes = g_cacheLoaded ? g_cacheBytes / g_cacheLoaded : 0;
+        size_t windowBytes = 0;
+        for (size_t i : wanted) {
+            windowBytes += c.loaded[i] ? imageBytes(*decodedImage(i)) : averageBytes;
+            if (windowBytes > g_cacheBudgetBytes && i != g_cacheCenter) break;
+            if (!needsDecode(i)) continue;
+            jobs.push_back({i, cacheDistance(i)});
+        }
+    }
+    if (g_holdDecodes) jobs.clear();
+    scheduleDecodes(jobs);
+}
+
+bool isImageFailed(size_t index) {
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+    return g_catalogue.failed[index];
+}
+
+int imageOrientation(size_t index) {
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+    int orientation = g_catalogue.orientation[index];
+    return orientation ? orientation : 1;
+}
+
+// Zoom at which the image exactly fits the window, 1 while its size is still unknown
+float fitScale(size_t index, SDL_Renderer* renderer) {
+    int winW, winH;
+    SDL_GetRendererOutputSize(renderer, &winW, &winH);
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+    const RawImage* img = decodedImage(index);
+    if (!img || !img->fullWidth || !img->fullHeight) return 1.0f;
+    bool sideways = orientationTransform(g_catalogue.orientation[index]).quarterTurns % 2;
+    int width = sideways ? img->fullHeight : img->fullWidth;
+    int height = sideways ? img->fullWidth : img->fullHeight;
+    return std::min((float)winW / width, (float)winH / height);
+}
+
+// Counts a navigation for the overlay's cache hit rate
+void countNavigation(size_t index) {
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+    g_navCount++;
+    if (g_catalogue.loaded[index]) g_navHits++;
+}
+
+// Overlay text: frame times, cache hit rate, decode queue depth and resident memory
+std::vector<std::string> hudLines(double frameAvgMs, double frameMaxMs) {
+    size_t queued;
+    {
+        std::lock_guard<std::mutex> lock(g_decodePool.mutex);
+        queued = g_decodePool.queue.size();
+    }
+    size_t navCount, navHits, resident, residentBytes, packed, packedBytes;
+    {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        navCount = g_navCount;
+        navHits = g_navHits;
+        resident = g_cacheLoaded;
+        residentBytes = g_cacheBytes;
+        packed = g_packed.size();
+        packedBytes = g_packedBytes;
+    }
+
+    char line[128];
+    std::vector<std::string> lines;
+    snprintf(line, sizeof(line), "FRAME %.1f MS AVG %.1f MS MAX", frameAvgMs, frameMaxMs);
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "CACHE HITS %.0f%% (%zu/%zu)", navCount ? 100.0 * navHits / navCount : 100.0, navHits, navCount);
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "DECODE QUEUE %zu", queued);
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "RESIDENT %zu IMAGES %zu/%zu MB", resident, residentBytes >> 20, g_cacheBudgetBytes >> 20);
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "PACKED %zu IMAGES %zu/%zu MB", packed, packedBytes >> 20, g_packedBudgetBytes >> 20);
+    lines.push_back(line);
+    int depth = prefetchDepth();
+    {
+        std::lock_guard<std::mutex> lock(g_readGate.mutex);
+        if (g_readGate.bandwidth > 0) {
+            snprintf(line, sizeof(line), "STORAGE %.0f MB/S %d READS PREFETCH %d", g_readGate.bandwidth / (1 << 20),
+                     std::min(g_readGate.limit, (int)g_decodePool.workers.size()), depth);
+            lines.push_back(line);
+        }
+    }
+    snprintf(line, sizeof(line), "RSS %.0f MB PEAK %.0f MB", currentRssMB(), peakRssMB());
+    lines.push_back(line);
+    return lines;
+}
+
+// ---------------------------------------------------------
+// Burst Groups
+// ---------------------------------------------------------
+
+// Consecutive near duplicates form a burst. Groups only span images that were decoded
+// and hashed, the prefetch window keeps the ones ahead hashed before the user gets there.
+
+// First and last image of the burst holding index. Caller must hold g_cacheMutex.
+std::pair<size_t, size_t> burstGroup(size_t index) {
+    size_t first = index, last = index;
+    while (first > 0 && g_catalogue.sameAsPrevious[first]) --first;
+    while (last + 1 < g_catalogue.size() && g_catalogue.sameAsPrevious[last + 1]) ++last;
+    return { first, last };
+}
+
+// Sharpest hashed image of a burst, its first image while none is hashed. Caller must hold g_cacheMutex.
+size_t sharpestInGroup(size_t first, size_t last) {
+    size_t best = first;
+    for (size_t i = first; i <= last; ++i) {
+        if (g_catalogue.hashed[i] && (!g_catalogue.hashed[best] || g_catalogue.sharpness[i] > g_catalogue.sharpness[best])) best = i;
+    }
+    return best;
+}
+
+// Sharpest image of the burst after (direction > 0) or before the one holding index.
+// Only that candidate becomes the cache center, so a zoom decodes just it at full resolution.
+size_t adjacentGroup(size_t index, int direction) {
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+    size_t n = g_catalogue.size();
+    auto [first, last] = burstGroup(index);
+    size_t next = (direction > 0) ? (last + 1) % n : (first + n - 1) % n;
+    auto [nextFirst, nextLast] = burstGroup(next);
+    return sharpestInGroup(nextFirst, nextLast);
+}
+
+size_t groupSize(size_t index) {
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+    auto [first, last] = burstGroup(index);
+    return last - first + 1;
+}
+
+// ---------------------------------------------------------
+// Review Journal
+// ---------------------------------------------------------
+
+// Marks and rotations are appended to {chosen dir}/.fiv-journal as fixed size records, flushed
+// and fsync'd once per status writer batch. Replaying it at startup restores the session, the
+// last record of an image wins. A record torn by a crash fails its check and ends the replay.
+const char kJournalMagic[4] = { 'F', 'I', 'V', 'J' };
+const uint32_t kJournalVersion = 1;
+
+// Images are identified by their path relative to the root, so the journal survives moving the folder
+uint64_t journalFileId(size_t index) {
+    const CatalogueDir& dir = g_catalogue.dirs[g_catalogue.dir[index]];
+    uint64_t hash = hashBytes(g_catalogue.arena.data() + dir.path + dir.pathLength - 1 - dir.relativeLength, dir.relativeLength);
+    hash = hashBytes("/", 1, hash);
+    return hashBytes(g_catalogue.arena.data() + g_catalogue.name[index], g_catalogue.nameLength[index], hash);
+}
+
+uint32_t journalCheck(const JournalRecord& record) {
+    return (uint32_t)hashBytes(&record, offsetof(JournalRecord, check));
+}
+
+JournalRecord journalRecord(size_t index, ImageStatus status, int orientation) {
+    JournalRecord record = {};
+    record.fileId = journalFileId(index);
+    record.status = (uint8_t)status;
+    record.orientation = (uint8_t)orientation;
+    record.check = journalCheck(record);
+    return record;
+}
+
+// Reads every intact record of a journal, oldest first. Returns false if there is no journal.
+bool readJournal(const fs::path& path, std::vector<JournalRecord>& records) {
+    std::ifstream in(path, std::ios::binary);
+    char magic[4];
+    uint32_t version = 0;
+    if (!in.read(magic, 4) || !in.read((char*)&version, sizeof(version))) return false;
+    if (memcmp(magic, kJournalMagic, 4) != 0 || version != kJournalVersion) return false;
+    JournalRecord record;
+    while (in.read((char*)&record, sizeof(record))) {
+        if (record.check != journalCheck(record) || record.status > (uint8_t)ImageStatus::Bad) break;
+        records.push_back(record);
+    }
+    return true;
+}
+
+// Flushes a directory's entries, so a rename or new file in it survives a crash
+void syncDirectory(const fs::path& dir) {
+#ifndef _WIN32
+    int fd = open(dir.string().c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+#else
+    (void)dir;
+#endif
+}
+
+// Replaces the journal with the given records, via a temporary file so a crash leaves either
+// the old or the new one. Returns the new journal open for appending, or null.
+FILE* rewriteJournal(const fs::path& path, const std::vector<JournalRecord>& records) {
+    fs::path tmpPath = temporaryPath(path);
+    FILE* f = fopen(tmpPath.string().c_str(), "wb");
+    if (!f) return nullptr;
+    bool ok = fwrite(kJournalMagic, 4, 1, f) == 1 && fwrite(&kJournalVersion, sizeof(kJournalVersion), 1, f) == 1 &&
+              (records.empty() || fwrite(records.data(), sizeof(JournalRecord), records.size(), f) == records.size());
+    ok = fflush(f) == 0 && ok;
+#ifndef _WIN32
+    ok = fsync(fileno(f)) == 0 && ok;
+#endif
+    ok = (fclose(f) == 0) && ok;
+    std::error_code ec;
+    if (ok) fs::rename(tmpPath, path, ec);
+    if (!ok || ec) {
+        fs::remove(tmpPath, ec);
+        return nullptr;
+    }
+    syncDirectory(path.parent_path());
+    return fopen(path.string().c_str(), "ab");
+}
+
+// Appends a batch and waits for it to reach the disk. Called by the status writer.
+void appendJournal(const std::vector<JournalRecord>& records) {
+    if (!g_journal || records.empty()) return;
+    TraceScope scope("appendJournal");
+    bool ok = fwrite(records.data(), sizeof(JournalRecord), records.size(), g_journal) == records.size() && fflush(g_journal) == 0;
+#ifndef _WIN32
+    ok = ok && fsync(fileno(g_journal)) == 0;
+#endif
+    if (!ok) std::cerr << "Failed to write the review journal" << std::endl;
+}
+
+// Restores marks and rotations from the journal in the chosen directory and opens it for the
+// session. Without a journal the existing links count as Good marks, as before journals existed.
+// Links that disagree with the journal, say after a crash mid-batch, are queued for repair.
+// A link to an image the journal doesn't mention was made by hand and counts as a Good mark,
+// a link to one of the images under a name that isn't its link name is removed.
+void openJournal() {
+    fs::path path = g_chosenDir / ".fiv-journal";
+    std::vector<JournalRecord> records;
+    bool found = readJournal(path, records);
+
+    std::unordered_map<uint64_t, JournalRecord> latest;
+    for (const JournalRecord& record : records) latest[record.fileId] = record;
+
+    Catalogue& c = g_catalogue;
+    std::unordered_set<std::string> chosen = listChosen(g_chosenDir);
+    std::vector<JournalRecord> current; // One record per image that isn't in its default state
+    size_t adopted = 0;
+    for (size_t i = 0; i < c.size(); ++i) {
+        std::string name = linkName(i);
+        bool linked = chosen.erase(name) != 0;
+        auto it = latest.find(journalFileId(i));
+        if (!found || it == latest.end()) {
+            if (linked) c.status[i] = ImageStatus::Good;
+            if (found && linked) adopted++;
+        } else {
+            c.status[i] = (ImageStatus)it->second.status;
+            if (it->second.orientation) c.orientation[i] = it->second.orientation;
+            if (linked != (c.status[i] == ImageStatus::Good)) g_statusWriter.pending[name] = { imagePath(i), c.status[i] };
+        }
+        if (c.status[i] != ImageStatus::Neutral || c.orientation[i]) current.push_back(journalRecord(i, c.status[i], c.orientation[i]));
+        if (found && linked && it == latest.end()) g_statusWriter.journal.push_back(current.back());
+    }
+
+    // What is left links under some other name, e.g. one an older version gave the image
+    std::unordered_set<std::string> images;
+    for (const std::string& name : chosen) {
+        std::error_code linkEc;
+        fs::path linkPath = g_chosenDir / name;
+        if (!fs::is_symlink(linkPath, linkEc)) continue;
+        if (images.empty()) {
+            for (size_t i = 0; i < c.size(); ++i) images.insert(imagePath(i));
+        }
+        fs::path target = fs::read_symlink(linkPath, linkEc);
+        if (!linkEc && images.count(target.string())) g_statusWriter.pending[name] = { target.string(), ImageStatus::Neutral };
+    }
+    if (adopted) std::cout << "Counted " << adopted << " links the journal doesn't know as Good marks." << std::endl;
+
+    // Fresh journals, torn ones and ones mostly made of superseded records are rewritten compacted,
+    // appending after a torn record would misalign everything that follows
+    std::error_code ec;
+    bool torn = found && fs::file_size(path, ec) != sizeof(kJournalMagic) + sizeof(kJournalVersion) + records.size() * sizeof(JournalRecord);
+    if (!found || torn || records.size() > 2 * current.size() + 1024) {
+        g_journal = rewriteJournal(path, current);
+    } else {
+        g_journal = fopen(path.string().c_str(), "ab");
+    }
+    if (!g_journal) std::cerr << "Review journal disabled, cannot write " << path << std::endl;
+    if (found) std::cout << "Restored " << current.size() << " review decisions from the journal." << std::endl;
+}
+
+// Queues a journal record with the image's current status and orientation
+void journalImage(size_t index, int orientation) {
+    std::lock_guard<std::mutex> lock(g_statusWriter.mutex);
+    g_statusWriter.journal.push_back(journalRecord(index, g_catalogue.status[index], orientation));
+}
+
+// ---------------------------------------------------------
+// Review Status
+// ---------------------------------------------------------
+
+// Applies the queued symlink changes. Only the latest status of each image is kept,
+// so toggling an image back and forth costs at most one change when the batch runs.
+void statusWriter() {
+    setTraceThreadName("status writer");
+    std::unique_lock<std::mutex> lock(g_statusWriter.mutex);
+    while (true) {
+        g_statusWriter.cv.wait(lock, [] {
+            return g_statusWriter.stopping || !g_statusWriter.pending.empty() || !g_statusWriter.journal.empty();
+        });
+        if (g_statusWriter.pending.empty() && g_statusWriter.journal.empty()) return;
+
+        // Let a burst of key presses collect into one batch
+        g_statusWriter.cv.wait_for(lock, kStatusBatchDelay, [] { return g_statusWriter.stopping; });
+        std::unordered_map<std::string, StatusChange> batch;
+        std::vector<JournalRecord> records;
+        batch.swap(g_statusWriter.pending);
+        records.swap(g_statusWriter.journal);
+        lock.unlock();
+
+        // The journal is the record of truth, it goes to disk before the links change
+        TraceScope scope("statusBatch");
+        appendJournal(records);
+        for (const auto& [filename, change] : batch) {
+            fs::path linkPath = g_chosenDir / filename;
+            std::error_code ec;
+            if (change.status == ImageStatus::Good) {
+                // Leave an existing link to the same image alone, replace anything else
+                if (fs::is_symlink(linkPath, ec) && fs::read_symlink(linkPath, ec) == change.target) continue;
+                fs::remove(linkPath, ec);
+                fs::create_symlink(change.target, linkPath, ec);
+                if (!ec) std::cout << "Symlink created: " << filename << "\n";
+            } else if (fs::remove(linkPath, ec)) {
+                std::cout << "Removed symlink for: " << filename << "\n";
+            }
+            if (ec) std::cerr << "File system error: " << filename << ": " << ec.message() << "\n";
+        }
+        std::cout.flush();
+        lock.lock();
+    }
+}
+
+void startStatusWriter() {
+    g_statusWriter.thread = std::thread(statusWriter);
+}
+
+// Writes out everything still queued, so no mark is lost on exit
+void stopStatusWriter() {
+    {
+        std::lock_guard<std::mutex> lock(g_statusWriter.mutex);
+        g_statusWriter.stopping = true;
+    }
+    g_statusWriter.cv.notify_all();
+    if (g_statusWriter.thread.joinable()) g_statusWriter.thread.join();
+    if (g_journal) fclose(g_journal);
+    g_journal = nullptr;
+}
+
+// Updates the status right away and queues the matching symlink change for the writer thread
+void setReviewStatus(size_t index, ImageStatus newStatus) {
+    if (g_catalogue.status[index] == newStatus) return;
+    TraceScope scope("setReviewStatus");
+
+    g_catalogue.status[index] = newStatus;
+    std::string name = linkName(index);
+    int orientation;
+    {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        orientation = g_catalogue.orientation[index];
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_statusWriter.mutex);
+        g_statusWriter.pending[name] = { imagePath(index), newStatus };
+        g_statusWriter.journal.push_back(journalRecord(index, newStatus, orientation));
+    }
+    g_statusWriter.cv.notify_one();
+
+    const char* label = (newStatus == ImageStatus::Good) ? "GOOD" : (newStatus == ImageStatus::Bad) ? "BAD" : "NEUTRAL";
+    std::cout << "Marked " << label << ": " << name << "\n";
+}
+
+// ---------------------------------------------------------
+// GPU Texture Ring
+// ---------------------------------------------------------
+
+TextureSlot* findTextureSlot(size_t index) {
+    for (auto& slot : g_textureSlots) {
+        if (slot.index == index) return &slot;
+    }
+    return nullptr;
+}
+
+// A slot can be drawn once all of its rows are on the GPU
+bool slotComplete(const TextureSlot* slot) {
+    return slot && slot->texture && slot->rowsUploaded == slot->height;
+}
+
+// Free slot for a new image, preferring one whose texture already has the right size and format
+TextureSlot* acquireTextureSlot(int width, int height, Uint32 format) {
+    TextureSlot* chosen = nullptr;
+    for (auto& slot : g_textureSlots) {
+        if (slot.index != SIZE_MAX) continue;
+        if (slot.texture && slot.width == width && slot.height == height && slot.format == format) return &slot;
+        if (!chosen) chosen = &slot;
+    }
+    return chosen;
+}
+
+// Pixels picked for a texture upload under the cache lock, copied out so the upload can run without it
+struct UploadSource {
+    SharedPixels pixels;
+    unsigned generation = 0; // Catalogue::generation when picked
+    int level = 0;
+    int width = 0;
+    int height = 0;
+    int fullWidth = 0;
+    int fullHeight = 0;
+    bool preview = false;
+    bool planar = false;
+};
+
+// Points a slot at new pixels. The texture is only recreated if the size or format changed.
+bool bindTextureSlot(SDL_Renderer* renderer, TextureSlot& slot, size_t index, const UploadSource& source, Uint32 format) {
+    int width = source.width, height = source.height;
+    if (slot.texture && (slot.width != width || slot.height != height || slot.format != format)) {
+        SDL_DestroyTexture(slot.texture);
+        slot.texture = nullptr;
+    }
+
+    if (!slot.texture) {
+        slot.texture = SDL_CreateTexture(
+            renderer,
+            format,
+            SDL_TEXTUREACCESS_STREAMING, // Streaming allows fast CPU->GPU updates
+            width,
+            height
+        );
+        if (!slot.texture) {
+            slot.index = SIZE_MAX;
+            return false;
+        }
+        // Set linear filtering for smooth scaling
+        SDL_SetTextureScaleMode(slot.texture, SDL_ScaleModeLinear);
+        slot.width = width;
+        slot.height = height;
+        slot.format = format;
+    }
+
+    slot.index = index;
+    slot.generation = source.generation;
+    slot.level = source.level;
+    slot.fullWidth = source.fullWidth ? source.fullWidth : width;
+    slot.fullHeight = source.fullHeight ? source.fullHeight : height;
+    slot.rowsUploaded = 0;
+    slot.preview = source.preview;
+    return true;
+}
+
+// Keeps the texture ring in sync with the decode cache. Called once per loop iteration.
+// The current image is uploaded in one go, its neighbours share a per-call byte budget,
+// so by the time the user presses Right the next texture is usually complete.
+// Returns true while neighbour uploads are left for the next call.
+bool updateTextures(SDL_Renderer* renderer) {
+    if (g_catalogue.size() == 0) return false;
+    TraceScope scope("updateTextures");
+
+    // Images the ring should hold, most urgent first
+    size_t n = g_catalogue.size();
+    std::vector<size_t> wanted = { g_currentIndex };
+    for (int step = 1; step <= g_textureRingRadius && wanted.size() < n; ++step) {
+        // Neighbours in the direction of travel come first
+        size_t forward = (g_currentIndex + step) % n;
+        size_t backward = (g_currentIndex + n - step % n) % n;
+        bool movingForward = g_navDirection >= 0;
+        for (size_t i : { movingForward ? forward : backward, movingForward ? backward : forward }) {
+            if (std::find(wanted.begin(), wanted.end(), i) == wanted.end()) wanted.push_back(i);
+        }
+    }
+
+    // Release slots that fell out of the ring, their textures are kept for reuse
+    for (auto& slot : g_textureSlots) {
+        if (slot.index != SIZE_MAX && std::find(wanted.begin(), wanted.end(), slot.index) == wanted.end()) {
+            slot.index = SIZE_MAX;
+        }
+    }
+
+    size_t budget = kUploadBytesPerFrame;
+    bool remaining = false;
+    for (size_t i : wanted) {
+        // Scrubbing only keeps the current image on screen, with whatever is cheapest to upload
+        if (g_scrubbing && i != g_currentIndex) continue;
+        TextureSlot* slot = findTextureSlot(i);
+        if (g_scrubbing && slotComplete(slot)) continue;
+
+        // The smallest level of the decode if resident, else the EXIF thumbnail. Zoomed in
+        // detail comes from tiles. When neither is resident (evicted) the slot keeps showing
+        // what it already has. The lock is only held while picking, the reference keeps the
+        // pixels alive through the upload even if a loader replaces them meanwhile.
+        UploadSource source;
+        {
+            std::lock_guard<std::mutex> lock(g_cacheMutex);
+            const RawImage* img = decodedImage(i);
+            if (!img) continue;
+            source.width = img->thumbWidth;
+            source.height = img->thumbHeight;
+            source.pixels = img->thumbData;
+            if (g_catalogue.loaded[i] && !(g_scrubbing && source.pixels)) {
+                source.level = mipLevelFor(*img, 0.0f);
+                source.pixels = levelPixels(*img, source.level, source.width, source.height);
+            }
+            if (!source.pixels) continue;
+            source.generation = g_catalogue.generation[i];
+            source.fullWidth = img->fullWidth;
+            source.fullHeight = img->fullHeight;
+            source.preview = source.pixels == img->thumbData;
+            source.planar = source.pixels == img->data && img->layout == PixelLayout::I420;
+        }
+
+        int width = source.width, height = source.height;
+        bool planar = source.planar;
+        const unsigned char* pixels = source.pixels.get();
+        Uint32 format = planar ? SDL_PIXELFORMAT_IYUV : SDL_PIXELFORMAT_RGBA32;
+        if (!slot || slot->generation != source.generation || slot->level != source.level || slot->preview != source.preview) {
+            if (!slot) slot = acquireTextureSlot(width, height, format);
+            if (!slot || !bindTextureSlot(renderer, *slot, i, source, format)) continue;
+        }
+        if (slotComplete(slot)) continue;
+
+        int rows = slot->height - slot->rowsUploaded;
+        if (i != g_currentIndex) {
+            if (budget == 0) {
+                remaining = true;
+                continue;
+            }
+            size_t rowBytes = planar ? (size_t)width * 3 / 2 : (size_t)width * 4;
+            int allowed = (int)std::max<size_t>(1, budget / rowBytes);
+            if (planar) allowed = std::max(2, allowed & ~1); // Bands start on even rows, a chroma row spans two
+            rows = std::min(rows, allowed);
+            budget -= std::min(budget, rows * rowBytes);
+        }
+
+        // Upload pixels to GPU
+        SDL_Rect band = { 0, slot->rowsUploaded, slot->width, rows };
+        auto uploadStart = TraceClock::now();
+        if (planar) {
+            int chromaWidth = (width + 1) / 2;
+            size_t chromaOffset = (size_t)(slot->rowsUploaded / 2) * chromaWidth;
+            const unsigned char* u = pixels + (size_t)width * height;
+            const unsigned char* v = u + (size_t)chromaWidth * ((height + 1) / 2);
+            SDL_UpdateYUVTexture(slot->texture, &band, pixels + (size_t)slot->rowsUploaded * width, width,
+                                 u + chromaOffset, chromaWidth, v + chromaOffset, chromaWidth);
+        } else {
+            SDL_UpdateTexture(slot->texture, &band, pixels + (size_t)slot->rowsUploaded * width * 4, width * 4);
+        }
+        recordStage(BenchStage::Upload, uploadStart);
+        slot->rowsUploaded += rows;
+        if (!slotComplete(slot)) remaining = true;
+
+        // Replaced while uploading: the slot holds the old pixels and is rebound next call
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        if (g_catalogue.generation[i] != source.generation) remaining = true;
+    }
+    return remaining;
+}
+
+// ---------------------------------------------------------
+// Tiled Zoom
+// ---------------------------------------------------------
+
+// Maps a vector in stored image orientation to the screen: the mirror, then clockwise quarter turns
+void toScreen(const DisplayTransform& transform, float& x, float& y) {
+    if (transform.mirror) x = -x;
+    for (int i = 0; i < transform.quarterTurns; ++i) {
+        float turned = -y;
+        y = x;
+        x = turned;
+    }
+}
+
+// Inverse of toScreen
+void fromScreen(const DisplayTransform& transform, float& x, float& y) {
+    for (int i = 0; i < transform.quarterTurns; ++i) {
+        float turned = y;
+        y = -x;
+        x = turned;
+    }
+    if (transform.mirror) x = -x;
+}
+
+// Keeps the view inside the image. Along an axis where the zoomed image is smaller
+// than the window the view stays centered.
+void clampPan(int fullWidth, int fullHeight, const DisplayTransform& transform, int winW, int winH) {
+    float halfW = winW / (2.0f * g_zoomScale), halfH = winH / (2.0f * g_zoomScale);
+    if (transform.quarterTurns % 2) std::swap(halfW, halfH);
+    float limitX = std::max(0.0f, fullWidth / 2.0f - halfW);
+    float limitY = std::max(0.0f, fullHeight / 2.0f - halfH);
+    g_panX = std::clamp(g_panX, -limitX, limitX);
+    g_panY = std::clamp(g_panY, -limitY, limitY);
+}
+
+// Moves the view by a screen space distance, in screen pixels
+void panBy(float dx, float dy, const DisplayTransform& transform) {
+    if (g_zoomScale <= 0.0f) return;
+    fromScreen(transform, dx, dy);
+    g_panX += dx / g_zoomScale;
+    g_panY += dy / g_zoomScale;
+}
+
+// Zooms in or out in powers of two, between fitting the window and 8:1. The image point at
+// the screen offset (anchorX, anchorY) from the window center stays where it is.
+void stepZoom(bool zoomIn, float fit, const DisplayTransform& transform, float anchorX, float anchorY) {
+    float previous = (g_zoomScale > 0.0f) ? g_zoomScale : fit;
+    float zoom = previous;
+    if (!zoomIn) {
+        zoom *= 0.5f;
+        if (zoom <= fit) zoom = 0.0f;
+    } else {
+        float step = 1.0f / 64.0f;
+        while (step <= zoom * 1.001f) step *= 2.0f;
+        zoom = std::min(step, 8.0f);
+    }
+
+    if (zoom > 0.0f) {
+        fromScreen(transform, anchorX, anchorY);
+        g_panX += anchorX / previous - anchorX / zoom;
+        g_panY += anchorY / previous - anchorY / zoom;
+    } else {
+        g_panX = g_panY = 0.0f;
+    }
+    g_zoomScale = zoom;
+    std::cout << "Zoom " << (zoom > 0.0f ? std::to_string(zoom) : "fit") << std::endl;
+}
+
+Tile* findTile(size_t index, unsigned generation, int level, int col, int row) {
+    for (auto& tile : g_tiles) {
+        if (tile.index == index && tile.generation == generation && tile.level == level && tile.col == col && tile.row == row) {
+            return &tile;
+        }
+    }
+    return nullptr;
+}
+
+// A new tile texture while under the cap, else the least recently drawn tile
+Tile* acquireTile(SDL_Renderer* renderer) {
+    if (g_tiles.size() < kMaxTiles) {
+        SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, kTileSize, kTileSize);
+        if (texture) {
+            SDL_SetTextureScaleMode(texture, SDL_ScaleModeLinear);
+            g_tiles.push_back(Tile());
+            g_tiles.back().texture = texture;
+            return &g_tiles.back();
+        }
+    }
+    Tile* oldest = nullptr;
+    for (auto& tile : g_tiles) {
+        if (tile.lastUsed == g_tileFrame) continue; // Already drawn this frame
+        if (!oldest || tile.lastUsed < oldest->lastUsed) oldest = &tile;
+    }
+    return oldest;
+}
+
+// Draws the visible tiles of the current image at the mip level matching the zoom, on top of
+// the low resolution texture already drawn. Missing tiles are uploaded nearest the center
+// first, a few per frame, so the full resolution fills in over the next frames.
+// Returns true while visible tiles are still missing.
+bool drawTiles(SDL_Renderer* renderer, size_t index, const DisplayTransform& transform, int winW, int winH) {
+    TraceScope scope("drawTiles");
+    g_tileFrame++;
+    // Only picking the level needs the cache lock, the reference keeps it alive for the uploads
+    SharedPixels levelData;
+    unsigned generation;
+    int level, levelWidth, levelHeight, fullWidth, fullHeight;
+    {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        const RawImage* img = decodedImage(index);
+        // A planar decode is a small image decoded whole, the ring texture already has every pixel
+        if (!g_catalogue.loaded[index] || !img->fullRes || img->layout != PixelLayout::Rgba) return false;
+        generation = g_catalogue.generation[index];
+        level = mipLevelFor(*img, g_zoomScale);
+        levelData = levelPixels(*img, level, levelWidth, levelHeight);
+        fullWidth = img->fullWidth;
+        fullHeight = img->fullHeight;
+    }
+    const unsigned char* pixels = levelData.get();
+    float levelScale = (float)levelWidth / fullWidth; // Level pixels per full resolution pixel
+
+    // Visible region in level pixels
+    float halfW = winW / (2.0f * g_zoomScale), halfH = winH / (2.0f * g_zoomScale);
+    if (transform.quarterTurns % 2) std::swap(halfW, halfH);
+    float centerX = (fullWidth / 2.0f + g_panX) * levelScale, centerY = (fullHeight / 2.0f + g_panY) * levelScale;
+    int firstCol = std::max(0, (int)((centerX - halfW * levelScale) / kTileSize));
+    int lastCol = std::min((levelWidth - 1) / kTileSize, (int)((centerX + halfW * levelScale) / kTileSize));
+    int firstRow = std::max(0, (int)((centerY - halfH * levelScale) / kTileSize));
+    int lastRow = std::min((levelHeight - 1) / kTileSize, (int)((centerY + halfH * levelScale) / kTileSize));
+
+    struct Visible {
+        int col, row;
+        float distance;
+    };
+    std::vector<Visible> visible;
+    for (int row = firstRow; row <= lastRow; ++row) {
+        for (int col = firstCol; col <= lastCol; ++col) {
+            float dx = (col + 0.5f) * kTileSize - centerX, dy = (row + 0.5f) * kTileSize - centerY;
+            visible.push_back({ col, row, dx * dx + dy * dy });
+        }
+    }
+    std::sort(visible.begin(), visible.end(), [](const Visible& a, const Visible& b) { return a.distance < b.distance; });
+
+    int uploads = kTileUploadsPerFrame;
+    bool missing = false;
+    float screenScale = g_zoomScale / levelScale; // Screen pixels per level pixel
+    for (const Visible& v : visible) {
+        int tileW = std::min(kTileSize, levelWidth - v.col * kTileSize);
+        int tileH = std::min(kTileSize, levelHeight - v.row * kTileSize);
+        Tile* tile = findTile(index, generation, level, v.col, v.row);
+        if (!tile) {
+            if (uploads == 0 || !(tile = acquireTile(renderer))) {
+                missing = true;
+                continue;
+            }
+            uploads--;
+            SDL_Rect area = { 0, 0, tileW, tileH };
+            const unsigned char* origin = pixels + ((size_t)v.row * kTileSize * levelWidth + (size_t)v.col * kTileSize) * 4;
+            auto uploadStart = TraceClock::now();
+            SDL_UpdateTexture(tile->texture, &area, origin, levelWidth * 4);
+            recordStage(BenchStage::Upload, uploadStart);
+            tile->index = index;
+            tile->generation = generation;
+            tile->level = level;
+            tile->col = v.col;
+            tile->row = v.row;
+        }
+        tile->lastUsed = g_tileFrame;
+
+        // Tile center relative to the view center, turned to the screen. SDL mirrors and
+        // rotates each tile around its own center, which matches the whole image transform.
+        float x = (v.col * kTileSize + tileW / 2.0f - centerX) * screenScale;
+        float y = (v.row * kTileSize + tileH / 2.0f - centerY) * screenScale;
+        toScreen(transform, x, y);
+        float w = tileW * screenScale, h = tileH * screenScale;
+        SDL_Rect source = { 0, 0, tileW, tileH };
+        SDL_FRect dest = { winW / 2.0f + x - w / 2, winH / 2.0f + y - h / 2, w, h };
+        SDL_RenderCopyExF(renderer, tile->texture, &source, &dest, transform.quarterTurns * 90.0, nullptr,
+                          transform.mirror ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE);
+    }
+
+    // Replaced while uploading: the tiles are of the old pixels, draw again with the new ones
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+    return missing || g_catalogue.generation[index] != generation;
+}
+
+// Draws a frame in place of an image that hasn't decoded yet, with an
+// animated bar as loading indicator, or a cross if the decode failed.
+void drawPlaceholder(SDL_Renderer* renderer, const SDL_Rect& rect, bool failed) {
+    SDL_SetRenderDrawColor(renderer, 35, 35, 35, 255);
+    SDL_RenderFillRect(renderer, &rect);
+
+    if (failed) {
+        SDL_SetRenderDrawColor(renderer, 90, 40, 40, 255);
+        SDL_RenderDrawLine(renderer, rect.x, rect.y, rect.x + rect.w - 1, rect.y + rect.h - 1);
+        SDL_RenderDrawLine(renderer, rect.x + rect.w - 1, rect.y, rect.x, rect.y + rect.h - 1);
+        return;
+    }
+
+    // Bar sweeping across a track in the middle of the frame
+    SDL_Rect track = { rect.x + rect.w / 4, rect.y + rect.h / 2 - 3, rect.w / 2, 6 };
+    SDL_SetRenderDrawColor(renderer, 55, 55, 55, 255);
+    SDL_RenderFillRect(renderer, &track);
+
+    int barW = std::max(1, track.w / 5);
+    int period = 1200; // ms per sweep
+    int phase = (int)(SDL_GetTicks() % period);
+    SDL_Rect bar = { track.x + (track.w - barW) * phase / period, track.y, barW, track.h };
+    SDL_SetRenderDrawColor(renderer, 150, 150, 150, 255);
+    SDL_RenderFillRect(renderer, &bar);
+}
+
+// Appends the four strips of a frame width px wide just inside rect, for batching into one fill.
+// Rects too small for the full width get a thinner frame, ones under 2 px are filled whole.
+void borderStrips(const SDL_Rect& rect, int width, std::vector<SDL_Rect>& strips) {
+    width = std::min(width, std::min(rect.w, rect.h) / 2);
+    if (width <= 0) {
+        if (rect.w > 0 && rect.h > 0) strips.push_back(rect);
+        return;
+    }
+    strips.push_back({ rect.x, rect.y, rect.w, width });
+    strips.push_back({ rect.x, rect.y + rect.h - width, rect.w, width });
+    strips.push_back({ rect.x, rect.y + width, width, rect.h - 2 * width });
+    strips.push_back({ rect.x + rect.w - width, rect.y + width, width, rect.h - 2 * width });
+}
+
+void fillRects(SDL_Renderer* renderer, const std::vector<SDL_Rect>& rects) {
+    if (!rects.empty()) SDL_RenderFillRects(renderer, rects.data(), (int)rects.size());
+}
+
+// Review status frame, 5 px wide just inside rect, drawn as four strips in one call
+void drawStatusBorder(SDL_Renderer* renderer, const SDL_Rect& rect) {
+    std::vector<SDL_Rect> strips;
+    borderStrips(rect, 5, strips);
+    fillRects(renderer, strips);
+}
+
+// ---------------------------------------------------------
+// Contact Sheet
+// ---------------------------------------------------------
+
+const int kAtlasColumns = kAtlasSize / kAtlasCell;
+
+// Cell of an atlas holding the image, or null
+AtlasCell* findAtlasCell(size_t index, int& atlas, int& cell) {
+    for (atlas = 0; atlas < (int)g_atlases.size(); ++atlas) {
+        std::vector<AtlasCell>& cells = g_atlases[atlas].cells;
+        for (cell = 0; cell < (int)cells.size(); ++cell) {
+            if (cells[cell].index == index) return &cells[cell];
+        }
+    }
+    return nullptr;
+}
+
+// A free cell, else the least recently shown one that isn't on screen
+AtlasCell* acquireAtlasCell(int& atlas, int& cell) {
+    AtlasCell* oldest = nullptr;
+    for (int a = 0; a < (int)g_atlases.size(); ++a) {
+        std::vector<AtlasCell>& cells = g_atlases[a].cells;
+        for (int c = 0; c < (int)cells.size(); ++c) {
+            if (cells[c].lastUsed == g_atlasFrame) continue;
+            if (!oldest || cells[c].index == SIZE_MAX || cells[c].lastUsed < oldest->lastUsed) {
+                oldest = &cells[c];
+                atlas = a;
+                cell = c;
+                if (cells[c].index == SIZE_MAX) return oldest;
+            }
+        }
+    }
+    return oldest;
+}
+
+// Clamps the first image of the sheet to the start of a row, no further than the last page
+void setGridFirst(long long first) {
+    long long n = (long long)g_catalogue.size();
+    long long lastRow = (n - 1) / kGridColumns;
+    long long maxRow = std::max(0LL, lastRow - (kGridRows - 1));
+    g_gridFirst = (size_t)std::clamp(first / kGridColumns, 0LL, maxRow) * kGridColumns;
+}
 
-bool isImageFile(const fs::path& path) {
-    std::string ext = path.extension().string();
-    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-    return (ext == ".jpg" || ext == ".jpeg" || ext == ".png" || ext == ".bmp" || ext == ".tga");
+// Scrolls the sheet by whole rows just enough to show the cursor
+void scrollGridToCursor() {
+    size_t row = g_currentIndex / kGridColumns, firstRow = g_gridFirst / kGridColumns;
+    if (row < firstRow) firstRow = row;
+    if (row >= firstRow + kGridRows) firstRow = row - (kGridRows - 1);
+    setGridFirst((long long)(firstRow * kGridColumns));
 }
 
-/**
- * Rotates raw RGBA pixel data 90 degrees clockwise in memory.
- */
-unsigned char* rotateImageClockwise(const unsigned char* in_data, int width, int height) {
-    int new_width = height;
-    int new_height = width;
-    int bytes_per_pixel = 4; // RGBA
+// Uploads the thumbnails of the page on screen into atlas cells, a few per call. Reuses a
+// cell until the image's pixels change; evicted images keep their cell contents. Sets remaining
+// while visible images are waiting for an upload. Returns true if anything was uploaded.
+bool updateAtlas(SDL_Renderer* renderer, bool& remaining) {
+    remaining = false;
+    if (g_atlases.empty()) {
+        for (int a = 0; a < kAtlasCount; ++a) {
+            SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, kAtlasSize, kAtlasSize);
+            if (!texture) break;
+            SDL_SetTextureScaleMode(texture, SDL_ScaleModeLinear);
+            g_atlases.push_back(Atlas());
+            g_atlases.back().texture = texture;
+            g_atlases.back().cells.resize(kAtlasColumns * kAtlasColumns);
+        }
+    }
+    TraceScope scope("updateAtlas");
+    g_atlasFrame++;
+    size_t last = std::min(g_catalogue.size(), g_gridFirst + kGridPage);
+    int atlas, cell;
 
-    // Allocate memory for the rotated image
-    unsigned char* out_data = (unsigned char*)malloc(new_width * new_height * bytes_per_pixel);
-    if (!out_data) return nullptr;
+    // Claim the cells already on screen first, so uploads don't take them
+    for (size_t i = g_gridFirst; i < last; ++i) {
+        if (AtlasCell* found = findAtlasCell(i, atlas, cell)) found->lastUsed = g_atlasFrame;
+    }
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            // Calculate source index (reading left-to-right, top-to-bottom)
-            size_t in_idx = (size_t)(y * width + x) * bytes_per_pixel;
+    int uploads = kAtlasUploadsPerFrame;
+    bool uploaded = false;
+    for (size_t i = g_gridFirst; i < last; ++i) {
+        AtlasCell* target = findAtlasCell(i, atlas, cell);
 
-            // Calculate destination index for 90-degree clockwise rotation:
-            // New x = old y
-            // New y = (width - 1) - old x
-            int new_x = y;
-            int new_y = (width - 1) - x;
-            size_t out_idx = (size_t)(new_y * new_width + new_x) * bytes_per_pixel;
+        // The smallest level of the decode if resident, else the EXIF thumbnail. Picked under
+        // the cache lock, converted and uploaded without it.
+        UploadSource source;
+        {
+            std::lock_guard<std::mutex> lock(g_cacheMutex);
+            const RawImage* img = decodedImage(i);
+            if (!img || (target && target->generation == g_catalogue.generation[i])) continue;
+            source.width = img->thumbWidth;
+            source.height = img->thumbHeight;
+            source.pixels = img->thumbData;
+            if (g_catalogue.loaded[i]) source.pixels = levelPixels(*img, mipLevelFor(*img, 0.0f), source.width, source.height);
+            if (!source.pixels) continue;
+            source.generation = g_catalogue.generation[i];
+            source.planar = source.pixels == img->data && img->layout == PixelLayout::I420;
+        }
+        if (uploads == 0) {
+            remaining = true;
+            continue;
+        }
+        if (!target && !(target = acquireAtlasCell(atlas, cell))) continue;
+        uploads--;
+
+        int width = source.width, height = source.height;
+        const unsigned char* pixels = source.pixels.get();
+        PixelBuffer converted;
+        if (source.planar) {
+            converted = i420ToRgba(pixels, width, height);
+            if (!(pixels = converted.get())) continue;
+        }
 
-            // Copy 4 bytes (RGBA)
-            out_data[out_idx + 0] = in_data[in_idx + 0];
-            out_data[out_idx + 1] = in_data[in_idx + 1];
-            out_data[out_idx + 2] = in_data[in_idx + 2];
-            out_data[out_idx + 3] = in_data[in_idx + 3];
+        // Box filter down to the cell size, very wide images are cropped
+        PixelBuffer shrunk;
+        while ((width > kAtlasCell || height > kAtlasCell) && width > 1 && height > 1) {
+            shrunk = halveImage(pixels, width, height);
+            if (!shrunk) break;
+            pixels = shrunk.get();
+            width /= 2;
+            height /= 2;
         }
+        int stride = width * 4;
+        width = std::min(width, kAtlasCell);
+        height = std::min(height, kAtlasCell);
+
+        SDL_Rect area = { (cell % kAtlasColumns) * kAtlasCell, (cell / kAtlasColumns) * kAtlasCell, width, height };
+        auto uploadStart = TraceClock::now();
+        SDL_UpdateTexture(g_atlases[atlas].texture, &area, pixels, stride);
+        recordStage(BenchStage::Upload, uploadStart);
+        target->index = i;
+        target->generation = source.generation; // A newer decode makes it stale, it is uploaded again
+        target->width = width;
+        target->height = height;
+        target->lastUsed = g_atlasFrame;
+        uploaded = true;
     }
-    return out_data;
+    return uploaded;
 }
 
-/**
- * Rotates raw RGBA pixel data 90 degrees counter-clockwise in memory.
- */
-unsigned char* rotateImageCounterClockwise(const unsigned char* in_data, int width, int height) {
-    int new_width = height;
-    int new_height = width;
-    int bytes_per_pixel = 4; // RGBA
+// Draws the page of thumbnails, each fitted into its grid cell in display orientation.
+// All thumbnails of an atlas go out in one SDL_RenderGeometry call and all frames of a
+// color in one fill, so the page costs a handful of draw calls however many images it has.
+void drawGrid(SDL_Renderer* renderer, int winW, int winH) {
+    TraceScope scope("drawGrid");
+    const int gap = 4;
+    size_t last = std::min(g_catalogue.size(), g_gridFirst + kGridPage);
+    size_t selectFirst = g_currentIndex, selectLast = g_currentIndex;
+    if (g_gridAnchor != SIZE_MAX) {
+        selectFirst = std::min(g_gridAnchor, g_currentIndex);
+        selectLast = std::max(g_gridAnchor, g_currentIndex);
+    }
 
-    // Allocate memory for the rotated image
-    unsigned char* out_data = (unsigned char*)malloc(new_width * new_height * bytes_per_pixel);
-    if (!out_data) return nullptr;
+    std::vector<std::vector<SDL_Vertex>> vertices(g_atlases.size());
+    std::vector<std::vector<int>> indices(g_atlases.size());
+    std::vector<SDL_Rect> selected, empty, good, bad, cursor;
+    {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        for (size_t i = g_gridFirst; i < last; ++i) {
+            int col = (int)((i - g_gridFirst) % kGridColumns), row = (int)((i - g_gridFirst) / kGridColumns);
+            int x0 = col * winW / kGridColumns, y0 = row * winH / kGridRows;
+            SDL_Rect frame = { x0, y0, (col + 1) * winW / kGridColumns - x0, (row + 1) * winH / kGridRows - y0 };
+            SDL_Rect inner = { frame.x + gap, frame.y + gap, frame.w - 2 * gap, frame.h - 2 * gap };
+            if (i >= selectFirst && i <= selectLast && g_gridAnchor != SIZE_MAX) selected.push_back(frame);
+            if (i == g_currentIndex) borderStrips(frame, 2, cursor);
+            if (g_catalogue.status[i] == ImageStatus::Good) borderStrips(inner, 3, good);
+            if (g_catalogue.status[i] == ImageStatus::Bad) borderStrips(inner, 3, bad);
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            // Calculate source index (reading left-to-right, top-to-bottom)
-            size_t in_idx = (size_t)(y * width + x) * bytes_per_pixel;
+            int atlas, cell;
+            const AtlasCell* found = findAtlasCell(i, atlas, cell);
+            if (!found) {
+                empty.push_back(inner);
+                continue;
+            }
 
-            // Calculate destination index for 90-degree counter-clockwise rotation:
-            // New x = (height - 1) - old y
-            // New y = old x
-            int new_x = (height - 1) - y;
-            int new_y = x;
-            size_t out_idx = (size_t)(new_y * new_width + new_x) * bytes_per_pixel;
+            // Fit to the frame with the on-screen aspect, then map each screen corner back
+            // to the stored orientation to find its texture coordinate
+            DisplayTransform transform = orientationTransform(g_catalogue.orientation[i] ? g_catalogue.orientation[i] : 1);
+            bool sideways = transform.quarterTurns % 2;
+            SDL_Rect fitted = fitToWindow(sideways ? found->height : found->width, sideways ? found->width : found->height, inner.w, inner.h);
+            float centerX = inner.x + fitted.x + fitted.w / 2.0f, centerY = inner.y + fitted.y + fitted.h / 2.0f;
+            float cellX = (float)((cell % kAtlasColumns) * kAtlasCell), cellY = (float)((cell / kAtlasColumns) * kAtlasCell);
 
-            // Copy 4 bytes (RGBA)
-            out_data[out_idx + 0] = in_data[in_idx + 0];
-            out_data[out_idx + 1] = in_data[in_idx + 1];
-            out_data[out_idx + 2] = in_data[in_idx + 2];
-            out_data[out_idx + 3] = in_data[in_idx + 3];
+            std::vector<SDL_Vertex>& quad = vertices[atlas];
+            int base = (int)quad.size();
+            const float corners[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+            for (const auto& corner : corners) {
+                float u = corner[0], v = corner[1];
+                fromScreen(transform, u, v);
+                // Half a texel in from the edge, so linear filtering doesn't pick up the next cell
+                SDL_Vertex vertex;
+                vertex.position = { centerX + corner[0] * fitted.w / 2.0f, centerY + corner[1] * fitted.h / 2.0f };
+                vertex.color = { 255, 255, 255, 255 };
+                vertex.tex_coord = { (cellX + 0.5f + (u + 1) / 2 * (found->width - 1)) / kAtlasSize,
+                                     (cellY + 0.5f + (v + 1) / 2 * (found->height - 1)) / kAtlasSize };
+                quad.push_back(vertex);
+            }
+            for (int k : { 0, 1, 2, 0, 2, 3 }) indices[atlas].push_back(base + k);
         }
     }
-    return out_data;
-}
 
-
-// Loads a single image into raw memory (CPU side)
-// This is designed to be thread-safe for parallel loading
-void loadImageIntoMemory(RawImage& img) {
-    // Force 4 channels (RGBA) for consistency with SDL textures
-    img.data = stbi_load(img.fullPath.c_str(), &img.width, &img.height, &img.channels, 4);
-    
-    if (img.data) {
-        // --- EXIF ORIENTATION HANDLING PLACEHOLDER ---
-        // A standard stbi_load does not respect the EXIF Orientation tag (e.g., rotation 6 or 8).
-        // To correctly handle vertical photos, you must integrate an EXIF parser library here.
-        //
-        // bool needs_90_degree_rotation = CheckExifOrientation(img.fullPath) == 6 || CheckExifOrientation(img.fullPath) == 8;
-        
-        // Since we cannot include an Exif library, we will leave the rotation commented out.
-        // UNCOMMENT AND IMPLEMENT THE EXIF CHECK BELOW FOR TRUE ORIENTATION:
-        /*
-        if (needs_90_degree_rotation) {
-            unsigned char* rotated_data = rotateImageClockwise(img.data, img.width, img.height);
-            if (rotated_data) {
-                stbi_image_free(img.data); // Free the original data
-                img.data = rotated_data;
-                // Swap dimensions after rotation
-                std::swap(img.width, img.height);
-            }
-        }
-        */
-        img.loaded = true;
-    } else {
-        img.loaded = false;
-        fprintf(stderr, "Failed to load: %s\n", img.fullPath.c_str());
+    SDL_SetRenderDrawColor(renderer, 45, 55, 80, 255);
+    fillRects(renderer, selected);
+    SDL_SetRenderDrawColor(renderer, 35, 35, 35, 255);
+    fillRects(renderer, empty);
+    for (size_t a = 0; a < g_atlases.size(); ++a) {
+        if (indices[a].empty()) continue;
+        SDL_RenderGeometry(renderer, g_atlases[a].texture, vertices[a].data(), (int)vertices[a].size(),
+                           indices[a].data(), (int)indices[a].size());
     }
+    SDL_SetRenderDrawColor(renderer, 50, 205, 50, 255); // Lime Green
+    fillRects(renderer, good);
+    SDL_SetRenderDrawColor(renderer, 220, 20, 60, 255); // Crimson Red
+    fillRects(renderer, bad);
+    SDL_SetRenderDrawColor(renderer, 230, 230, 230, 255);
+    fillRects(renderer, cursor);
 }
 
-// Handles creating/removing symlinks and updating status
-void setReviewStatus(RawImage& img, ImageStatus newStatus) {
-    if (img.status == newStatus) return;
-
-    img.status = newStatus;
-    fs::path linkPath = g_chosenDir / img.filename;
+// Keys while the contact sheet is up. Returns false for keys it leaves to the main handler.
+bool handleGridKey(const SDL_Keysym& key) {
+    long long step = 0;
+    switch (key.sym) {
+        case SDLK_RIGHT: step = 1; break;
+        case SDLK_LEFT: step = -1; break;
+        case SDLK_DOWN: step = kGridColumns; break;
+        case SDLK_UP: step = -kGridColumns; break;
+        case SDLK_PAGEDOWN: step = (long long)kGridPage; break;
+        case SDLK_PAGEUP: step = -(long long)kGridPage; break;
 
-    try {
-        if (newStatus == ImageStatus::Good) {
-            // Create symlink
-            if (fs::exists(linkPath)) fs::remove(linkPath); // Clear old if exists
-            fs::create_symlink(img.fullPath, linkPath);
-            std::cout << "Marked GOOD: " << img.filename << " -> Symlink created." << std::endl;
-        } else {
-            // Remove symlink if transitioning to Bad or Neutral
-            if (fs::exists(linkPath) || fs::is_symlink(linkPath)) {
-                fs::remove(linkPath);
-                std::cout << "Removed symlink for: " << img.filename << std::endl;
-            }
-            
-            if (newStatus == ImageStatus::Bad) {
-                std::cout << "Marked BAD: " << img.filename << std::endl;
-            } else {
-                std::cout << "Marked NEUTRAL: " << img.filename << std::endl;
+        // Mark the selection, or just the cursor
+        case SDLK_b:
+        case SDLK_n: {
+            size_t first = g_currentIndex, last = g_currentIndex;
+            if (g_gridAnchor != SIZE_MAX) {
+                first = std::min(g_gridAnchor, g_currentIndex);
+                last = std::max(g_gridAnchor, g_currentIndex);
             }
+            for (size_t i = first; i <= last; ++i) {
+                setReviewStatus(i, key.sym == SDLK_b ? ImageStatus::Bad : ImageStatus::Neutral);
+            }
+            g_gridAnchor = SIZE_MAX;
+            return true;
         }
-    } catch (const std::exception& e) {
-        std::cerr << "File system error: " << e.what() << std::endl;
-    }
-}
 
-// Updates the GPU texture with specific image data
-void updateTexture(SDL_Renderer* renderer) {
-    if (g_images.empty()) return;
-    
-    RawImage& current = g_images[g_currentIndex];
-    if (!current.loaded || !current.data) return;
+        // Back to the single image view, on the cursor
+        case SDLK_c:
+        case SDLK_RETURN:
+            g_gridMode = false;
+            g_gridAnchor = SIZE_MAX;
+            g_panX = g_panY = 0.0f;
+            countNavigation(g_currentIndex);
+            std::cout << "Contact sheet off" << std::endl;
+            return true;
 
-    // If texture exists but dimensions are different, destroy it
-    if (g_displayTexture && (g_texWidth != current.width || g_texHeight != current.height)) {
-        SDL_DestroyTexture(g_displayTexture);
-        g_displayTexture = nullptr;
+        // The single image keys have no meaning here
+        default:
+            return key.sym != SDLK_h && key.sym != SDLK_ESCAPE;
     }
 
-    // Create texture if needed
-    if (!g_displayTexture) {
-        g_displayTexture = SDL_CreateTexture(
-            renderer,
-            SDL_PIXELFORMAT_RGBA32,
-            SDL_TEXTUREACCESS_STREAMING, // Streaming allows fast CPU->GPU updates
-            current.width,
-            current.height
-        );
-        g_texWidth = current.width;
-        g_texHeight = current.height;
+    // Shift extends the selection from where it started
+    if (key.mod & KMOD_SHIFT) {
+        if (g_gridAnchor == SIZE_MAX) g_gridAnchor = g_currentIndex;
+    } else {
+        g_gridAnchor = SIZE_MAX;
     }
-
-    // Upload pixels to GPU
-    SDL_UpdateTexture(g_displayTexture, nullptr, current.data, current.width * 4);
-    
-    // Set linear filtering for smooth scaling
-    SDL_SetTextureScaleMode(g_displayTexture, SDL_ScaleModeLinear);
-    
-    std::cout << "[" << (g_currentIndex + 1) << "/" << g_images.size() << "] Viewing: " << current.filename << std::endl;
+    long long n = (long long)g_catalogue.size();
+    g_currentIndex = (size_t)std::clamp((long long)g_currentIndex + step, 0LL, n - 1);
+    g_navDirection = step > 0 ? 1 : -1;
+    if (key.sym == SDLK_PAGEDOWN || key.sym == SDLK_PAGEUP) setGridFirst((long long)g_gridFirst + step);
+    scrollGridToCursor();
+    return true;
 }
 
 // ---------------------------------------------------------
-// Main Application
+// Collection Setup
 // ---------------------------------------------------------
 
-int main(int argc, char* argv[]) {
-    // 1. Argument Parsing
-    std::string inputPathStr = ".";
-    if (argc > 1) {
-        inputPathStr = argv[1];
-    }
-
+// Everything both the viewer and the headless batch need: the chosen directory, the disk
+// cache, the catalogue and the journal. Returns false after reporting what went wrong.
+bool openCollection(const std::string& inputPathStr, bool recursive) {
     fs::path inputDir(inputPathStr);
 
     if (!fs::exists(inputDir) || !fs::is_directory(inputDir)) {
         std::cerr << "Error: Directory not found -> " << inputPathStr << std::endl;
-        return 1;
+        return false;
     }
 
     // Resolve to absolute path so all stored paths are absolute
     inputDir = fs::absolute(inputDir);
+    g_rootDir = inputDir;
 
     // Setup output directory: {cwd}/{folder_name}_chosen
     std::string dirName = inputDir.filename().string();
@@ -273,70 +4828,714 @@ int main(int argc, char* argv[]) {
             std::cout << "Created output directory: " << g_chosenDir << std::endl;
         } catch (const std::exception& e) {
             std::cerr << "Error creating output directory: " << e.what() << std::endl;
-            return 1;
+            return false;
         }
     } else {
         std::cout << "Using output directory: " << g_chosenDir << std::endl;
     }
 
-    // 2. Scan Directory
-    std::vector<fs::path> foundFiles;
-    std::cout << "Scanning directory: " << inputPathStr << " ..." << std::endl;
-    for (const auto& entry : fs::directory_iterator(inputDir)) {
-        if (entry.is_regular_file() && isImageFile(entry.path())) {
-            foundFiles.push_back(entry.path());
+    // Previews and scan results from earlier runs make reopening a folder nearly free
+    if (g_usePreviewCache || g_useScanCache) {
+        g_diskCacheDir = defaultDiskCacheDir();
+        std::error_code ec;
+        if (!g_diskCacheDir.empty() && !fs::create_directories(g_diskCacheDir, ec) && ec) {
+            std::cerr << "Disk cache disabled, cannot create " << g_diskCacheDir << ": " << ec.message() << std::endl;
+            g_diskCacheDir.clear();
         }
     }
-    
-    // Sort files alphabetically
-    std::sort(foundFiles.begin(), foundFiles.end());
 
-    if (foundFiles.empty()) {
+    // Scan the directory
+    std::cout << "Scanning directory: " << inputPathStr << (recursive ? " recursively" : "") << " ..." << std::endl;
+    g_catalogue = scanDirectory(inputDir, recursive);
+
+    if (g_catalogue.size() == 0) {
         std::cerr << "No images found in directory." << std::endl;
-        return 1;
+        return false;
     }
 
-    // 3. Pre-allocation
-    size_t count = foundFiles.size();
-    g_images.resize(count);
-    
-    // 4. Parallel Loading Phase
-    std::cout << "Loading " << count << " images into System RAM..." << std::endl;
-    
-    auto startTime = std::chrono::high_resolution_clock::now();
-    std::vector<std::future<void>> futures;
+    // Restore the review state of earlier sessions (persistence)
+    openJournal();
+    return true;
+}
+
+// ---------------------------------------------------------
+// Headless Batch
+// ---------------------------------------------------------
+
+// Writes the given pieces one after another to path, via a temporary file renamed into place
+bool writeFileAtomically(const fs::path& path, const std::vector<std::pair<const void*, size_t>>& pieces) {
+    fs::path tmpPath = temporaryPath(path);
+    FILE* f = fopen(tmpPath.string().c_str(), "wb");
+    if (!f) return false;
+    bool ok = true;
+    for (const auto& [data, size] : pieces) ok = ok && (size == 0 || fwrite(data, 1, size, f) == size);
+    ok = (fclose(f) == 0) && ok;
+    std::error_code ec;
+    if (ok) fs::rename(tmpPath, path, ec);
+    if (!ok || ec) fs::remove(tmpPath, ec);
+    return ok && !ec;
+}
+
+// CRC-32 as used by PNG chunks
+uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Encodes RGBA pixels as a PNG. The deflate stream uses stored blocks only, which keeps the
+// encoder tiny at the cost of file size; it is only used for the rare export that needs it.
+std::vector<unsigned char> encodePng(const unsigned char* pixels, int width, int height) {
+    std::vector<unsigned char> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    auto put32 = [](std::vector<unsigned char>& out, uint32_t v) {
+        for (int shift = 24; shift >= 0; shift -= 8) out.push_back((unsigned char)(v >> shift));
+    };
+    auto chunk = [&](const char* type, const std::vector<unsigned char>& body) {
+        put32(png, (uint32_t)body.size());
+        size_t start = png.size();
+        png.insert(png.end(), type, type + 4);
+        png.insert(png.end(), body.begin(), body.end());
+        put32(png, crc32(png.data() + start, png.size() - start));
+    };
+
+    std::vector<unsigned char> header;
+    put32(header, (uint32_t)width);
+    put32(header, (uint32_t)height);
+    header.insert(header.end(), { 8, 6, 0, 0, 0 }); // 8 bit RGBA, no interlace
+    chunk("IHDR", header);
+
+    // Rows prefixed with filter type 0, wrapped in a zlib stream of stored blocks
+    size_t rowBytes = (size_t)width * 4;
+    std::vector<unsigned char> raw;
+    raw.reserve((rowBytes + 1) * height);
+    for (int y = 0; y < height; ++y) {
+        raw.push_back(0);
+        raw.insert(raw.end(), pixels + y * rowBytes, pixels + (y + 1) * rowBytes);
+    }
+    std::vector<unsigned char> zlib = { 0x78, 0x01 };
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    uint32_t a = 1, b = 0;
+    size_t at = 0;
+    do {
+        size_t length = std::min<size_t>(raw.size() - at, 65535);
+        zlib.push_back(at + length == raw.size() ? 1 : 0);
+        zlib.insert(zlib.end(), { (unsigned char)length, (unsigned char)(length >> 8),
+                                  (unsigned char)~length, (unsigned char)(~length >> 8) });
+        zlib.insert(zlib.end(), raw.begin() + at, raw.begin() + at + length);
+        for (size_t i = at; i < at + length; ++i) {
+            a = (a + raw[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        at += length;
+    } while (at < raw.size());
+    put32(zlib, (b << 16) | a);
+    chunk("IDAT", zlib);
+    chunk("IEND", {});
+    return png;
+}
+
+// EXIF orientation of an exported JPEG, 0 if it can't be read
+int exportedOrientation(const fs::path& path) {
+    MappedFile file;
+    ExifInfo exif;
+    if (!openFile(path.string(), file, kThumbnailPrefix) || !parseExif(file.data(), file.size(), exif)) return 0;
+    return exif.orientation;
+}
+
+enum class ExportResult {
+    UpToDate,
+    Copied,
+    Retagged,   // Copied with the EXIF Orientation tag set to the user's rotation
+    Reencoded,  // Written upright as a PNG, for rotated images without a tag to rewrite
+    Unorientable, // The user's rotation can't be kept, nothing was written
+    Failed
+};
+
+// The PNG an untagged rotated image is exported as
+fs::path uprightPath(const fs::path& target) {
+    fs::path png = target;
+    return png.replace_extension(".png");
+}
+
+// Writes the image upright, decoded at full resolution and turned by the orientation kernel
+ExportResult exportUpright(const MappedFile& file, int orientation, const fs::path& target) {
+    DecodedSize size;
+    PixelBuffer pixels = decodeImage(file.data(), file.size(), 0, 0, size);
+    if (!pixels) return ExportResult::Unorientable;
+    PixelBuffer upright = orientImage(pixels.get(), size.width, size.height, orientation);
+    if (!upright) return ExportResult::Unorientable;
+    bool swapped = orientation >= 5;
+    std::vector<unsigned char> png = encodePng(upright.get(), swapped ? size.height : size.width, swapped ? size.width : size.height);
+    return writeFileAtomically(uprightPath(target), { { png.data(), png.size() } }) ? ExportResult::Reencoded : ExportResult::Failed;
+}
+
+// Exports one image. Without a rotation of the user's the file is copied as is, with one a JPEG
+// gets its Orientation tag rewritten in the copy, which is lossless and leaves the pixels alone.
+// Anything else is written upright as a PNG next to where the copy would have gone.
+ExportResult exportImage(size_t index, const fs::path& target) {
+    std::string source = imagePath(index);
+    int wanted;
+    {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        wanted = g_catalogue.orientation[index];
+    }
+
+    MappedFile file;
+    if (!openFile(source, file)) return ExportResult::Failed;
+    ExifInfo exif;
+    bool tagged = parseExif(file.data(), file.size(), exif) && exif.orientationOffset;
+    if (!wanted) wanted = exif.orientation; // Never read, so never rotated either
+    std::error_code ec;
+    bool fresh = fs::exists(target, ec) && fs::last_write_time(target, ec) >= fs::last_write_time(source, ec) && !ec;
+
+    if ((tagged || wanted == exif.orientation) && uprightPath(target) != target) {
+        fs::remove(uprightPath(target), ec); // Left by an earlier export of a rotation
+    }
+    if (wanted == exif.orientation) {
+        // Up to date unless an earlier export wrote a rotation the user has since undone
+        if (fresh && (!tagged || exportedOrientation(target) == wanted)) return ExportResult::UpToDate;
+        return writeFileAtomically(target, { { file.data(), file.size() } }) ? ExportResult::Copied : ExportResult::Failed;
+    }
+    if (!tagged) {
+        // The PNG carries no record of the rotation it was written with, so it is always redone
+        fs::remove(target, ec);
+        return exportUpright(file, wanted, target);
+    }
+    if (fresh && exportedOrientation(target) == wanted) return ExportResult::UpToDate;
+
+    unsigned char value[2] = { 0, 0 };
+    value[exif.littleEndian ? 0 : 1] = (unsigned char)wanted;
+    size_t at = exif.orientationOffset;
+    bool written = writeFileAtomically(target, { { file.data(), at }, { value, 2 }, { file.data() + at + 2, file.size() - at - 2 } });
+    return written ? ExportResult::Retagged : ExportResult::Failed;
+}
+
+// Copies the images marked good to dir under their link names, with the rotations made in the
+// viewer applied. Copies that are already up to date are left alone, so exporting again only
+// writes what changed.
+void exportGood(const fs::path& dir) {
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    size_t good = 0, copied = 0, retagged = 0, reencoded = 0, unorientable = 0, failed = 0;
+    for (size_t i = 0; i < g_catalogue.size(); ++i) {
+        if (g_catalogue.status[i] != ImageStatus::Good) continue;
+        good++;
+        switch (exportImage(i, dir / linkName(i))) {
+            case ExportResult::UpToDate: break;
+            case ExportResult::Copied: copied++; break;
+            case ExportResult::Retagged: retagged++; break;
+            case ExportResult::Reencoded: reencoded++; break;
+            case ExportResult::Unorientable:
+                unorientable++;
+                std::cerr << "Not exported, cannot apply the rotation to " << imagePath(i) << std::endl;
+                break;
+            case ExportResult::Failed:
+                failed++;
+                std::cerr << "Failed to export " << imagePath(i) << std::endl;
+                break;
+        }
+    }
+    std::cout << "Exported " << good << " good images to " << dir << ", " << copied << " copied, " << retagged
+              << " with the rotation written to their EXIF tag, " << reencoded << " rewritten upright as PNG." << std::endl;
+    if (unorientable) std::cout << unorientable << " rotated images could not be oriented." << std::endl;
+    if (failed) std::cout << failed << " images failed to copy." << std::endl;
+}
+
+// With warmCaches, decodes every image once with the whole decode pool and no window. Each
+// decode writes its preview, hash included, and is dropped right away. The journal was already
+// replayed by openCollection, stopping the status writer flushes it and any link repairs.
+int runHeadless(bool warmCaches, const fs::path& exportDir) {
+    setTraceThreadName("main");
+    Catalogue& c = g_catalogue;
+    size_t count = c.size();
+    bool warm = warmCaches && g_usePreviewCache && !g_diskCacheDir.empty();
+
+    // Nothing gets drawn, every decode only lives until its preview is written
+    g_cacheBudgetBytes = 0;
+    g_packedBudgetBytes = 0;
+    g_planarDecodes = false;
+
+    auto startTime = TraceClock::now();
+    startStatusWriter();
+    startCacheSweeper();
+    if (warm) {
+        startDecodePool();
+        std::cout << "Warming the preview cache for " << count << " images at " << g_targetWidth << "x" << g_targetHeight << " ..." << std::endl;
+        std::vector<DecodeJob> jobs;
+        for (size_t i = 0; i < count; ++i) jobs.push_back({ i, i });
+        scheduleDecodes(jobs);
+
+        size_t reported = 0;
+        auto lastReport = TraceClock::now();
+        while (!decodePoolIdle()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            if (TraceClock::now() - lastReport < std::chrono::seconds(5)) continue;
+            size_t done = 0;
+            {
+                std::lock_guard<std::mutex> lock(g_cacheMutex);
+                for (size_t i = 0; i < count; ++i) done += c.hashed[i] || c.failed[i];
+            }
+            if (done != reported) std::cout << "  " << done << " / " << count << std::endl;
+            reported = done;
+            lastReport = TraceClock::now();
+        }
+    } else if (warmCaches) {
+        std::cout << "The disk cache is disabled, there is nothing to warm." << std::endl;
+    }
+    stopDecodePool();
+    stopStatusWriter();
+    stopCacheSweeper();
+
+    if (warm) {
+        size_t failed = 0;
+        for (size_t i = 0; i < count; ++i) failed += c.failed[i];
+        std::chrono::duration<double> elapsed = TraceClock::now() - startTime;
+        printf("Prepared %zu previews in %.1f s (%.1f images/s), %zu failed.\n", count - failed, elapsed.count(),
+               count / std::max(elapsed.count(), 1e-9), failed);
+    }
+    if (!exportDir.empty()) exportGood(exportDir);
+
+    if (!g_traceOutput.empty()) writeTrace(g_traceOutput);
+    g_decoded.clear();
+    return 0;
+}
+
+// ---------------------------------------------------------
+// Directory Watch
+// ---------------------------------------------------------
+
+// Tethered shooting keeps adding files. Each reviewed directory is watched with inotify, files
+// that finished writing or were moved in are inserted in their sorted place and decoded through
+// the normal window. Each directory is listed again right after its watch is added, so a file
+// that landed between the scan and the watch is still picked up. With --recursive every
+// subdirectory is watched, including ones created later. Other platforms keep the list from
+// the scan.
+
+std::string_view imageRelativeDir(size_t index) {
+    const CatalogueDir& dir = g_catalogue.dirs[g_catalogue.dir[index]];
+    return std::string_view(g_catalogue.arena).substr(dir.path + dir.pathLength - 1 - dir.relativeLength, dir.relativeLength);
+}
+
+std::string_view imageName(size_t index) {
+    return std::string_view(g_catalogue.arena).substr(g_catalogue.name[index], g_catalogue.nameLength[index]);
+}
+
+// Number of images sorting before a relative path, its index if it is in the catalogue
+size_t cataloguePosition(std::string_view relative, std::string_view name) {
+    size_t lo = 0, hi = g_catalogue.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (pathBefore(imageRelativeDir(mid), imageName(mid), relative, name)) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+// Index of an image given by relative path, SIZE_MAX if the catalogue doesn't have it
+size_t catalogueFind(std::string_view relative, std::string_view name) {
+    size_t index = cataloguePosition(relative, name);
+    bool found = index < g_catalogue.size() && imageRelativeDir(index) == relative && imageName(index) == name;
+    return found ? index : SIZE_MAX;
+}
+
+#ifdef __linux__
+// Watches a directory and, when recursive, the directories below it, reporting every image
+// found in them to found. Only the main thread before the watch thread starts, or the watch
+// thread itself, may call this.
+void watchTree(const std::string& top, std::vector<WatchArrival>& found) {
+    std::vector<std::string> pending = { top };
+    while (!pending.empty()) {
+        std::string relative = std::move(pending.back());
+        pending.pop_back();
+        if (g_watcher.watched.count(relative)) continue;
+        fs::path path = relative.empty() ? g_rootDir : g_rootDir / relative;
+        uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | (g_watcher.recursive ? IN_CREATE : 0);
+        int wd = inotify_add_watch(g_watcher.fd, path.string().c_str(), mask);
+        if (wd < 0) continue;
+        g_watcher.dirs[wd] = relative;
+        g_watcher.watched.insert(relative);
+
+        ScannedDir contents = listDirectory(path, g_watcher.recursive, g_chosenDir);
+        for (std::string& name : contents.files) {
+            if (name[0] != '.') found.push_back({ relative, std::move(name) });
+        }
+        for (const std::string& sub : contents.subdirs) pending.push_back(relative.empty() ? sub : relative + "/" + sub);
+    }
+}
+#endif
+
+void watchWorker() {
+    setTraceThreadName("watch");
+#ifdef __linux__
+    alignas(inotify_event) char buffer[16384];
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(g_watcher.mutex);
+            if (g_watcher.stopping) return;
+        }
+        pollfd ready = { g_watcher.fd, POLLIN, 0 };
+        if (poll(&ready, 1, 250) <= 0) continue;
+        ssize_t length = read(g_watcher.fd, buffer, sizeof(buffer));
+        if (length <= 0) continue;
+
+        std::vector<WatchArrival> found;
+        for (ssize_t offset = 0; offset < length;) {
+            const inotify_event* event = (const inotify_event*)(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+            auto dir = g_watcher.dirs.find(event->wd);
+            if (dir == g_watcher.dirs.end()) continue;
+            if (event->mask & IN_IGNORED) {
+                // The directory is gone, a new one of the same name gets a new watch
+                g_watcher.watched.erase(dir->second);
+                g_watcher.dirs.erase(dir);
+                continue;
+            }
+            if (!event->len || event->name[0] == '.') continue;
+            std::string name = event->name;
+            if (event->mask & IN_ISDIR) {
+                // A new subdirectory may already hold files by the time its watch is added
+                std::string relative = dir->second.empty() ? name : dir->second + "/" + name;
+                if (g_watcher.recursive && g_rootDir / relative != g_chosenDir) watchTree(relative, found);
+            } else if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && isImageFile(name)) {
+                found.push_back({ dir->second, name }); // A file's IN_CREATE waits for it to be written
+            }
+        }
+        if (found.empty()) continue;
+        {
+            std::lock_guard<std::mutex> lock(g_watcher.mutex);
+            g_watcher.arrived.insert(g_watcher.arrived.end(), found.begin(), found.end());
+        }
+        wakeMainLoop();
+    }
+#endif
+}
+
+void startWatcher(bool recursive) {
+#ifdef __linux__
+    g_watcher.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (g_watcher.fd < 0) return;
+    g_watcher.recursive = recursive;
+    std::vector<WatchArrival> found;
+    watchTree("", found);
+
+    // Files the scan missed, the ones it saw are already in the catalogue
+    std::vector<WatchArrival> missed;
+    for (WatchArrival& arrival : found) {
+        if (catalogueFind(arrival.relative, arrival.name) == SIZE_MAX) missed.push_back(std::move(arrival));
+    }
+    if (!missed.empty()) {
+        std::lock_guard<std::mutex> lock(g_watcher.mutex);
+        g_watcher.arrived.swap(missed);
+    }
+    g_watcher.thread = std::thread(watchWorker);
+#else
+    (void)recursive;
+#endif
+}
+
+void stopWatcher() {
+    {
+        std::lock_guard<std::mutex> lock(g_watcher.mutex);
+        g_watcher.stopping = true;
+    }
+    if (g_watcher.thread.joinable()) g_watcher.thread.join();
+#ifndef _WIN32
+    if (g_watcher.fd >= 0) close(g_watcher.fd);
+#endif
+    g_watcher.fd = -1;
+}
+
+bool haveArrivals() {
+    std::lock_guard<std::mutex> lock(g_watcher.mutex);
+    return !g_watcher.arrived.empty();
+}
+
+// Moves the entries of a per image array to their new indexes, new images get fill
+template <typename T>
+void spreadOut(std::vector<T>& values, const std::vector<size_t>& oldToNew, size_t total, T fill) {
+    std::vector<T> spread(total, fill);
+    for (size_t i = 0; i < oldToNew.size(); ++i) spread[oldToNew[i]] = values[i];
+    values.swap(spread);
+}
+
+// Forgets everything derived from an image whose file was rewritten: decode, packed copy, GPU
+// copies and signature. Unlike evictImage nothing moves down to the packed tier. The next
+// updatePrefetchWindow queues it again if it is in the window. Caller must hold g_cacheMutex.
+void discardRewritten(size_t index) {
+    Catalogue& c = g_catalogue;
+    if (RawImage* img = decodedImage(index)) {
+        g_cacheBytes -= imageBytes(*img);
+        if (c.loaded[index]) g_cacheLoaded--;
+        img->data.reset();
+        img->thumbData.reset();
+        img->mips.clear();
+        releaseDecoded(index);
+    }
+    c.loaded[index] = false;
+    c.failed[index] = false;
+    c.wantFullRes[index] = false;
+    c.thumbChecked[index] = false;
+    c.generation[index]++;
+
+    auto packed = g_packed.find(index);
+    if (packed != g_packed.end()) {
+        g_packedBytes -= packed->second->bytes.size();
+        g_packed.erase(packed);
+    }
+    for (TextureSlot& slot : g_textureSlots) {
+        if (slot.index == index) slot.index = SIZE_MAX;
+    }
+    for (Tile& tile : g_tiles) {
+        if (tile.index == index) tile.index = SIZE_MAX;
+    }
+    for (Atlas& atlas : g_atlases) {
+        for (AtlasCell& cell : atlas.cells) {
+            if (cell.index == index) cell.index = SIZE_MAX;
+        }
+    }
 
-    for (size_t i = 0; i < count; ++i) {
-        g_images[i].filename = foundFiles[i].filename().string();
-        g_images[i].fullPath = foundFiles[i].string();
-        
-        // Check if already chosen (persistence)
-        if (fs::exists(g_chosenDir / g_images[i].filename)) {
-            g_images[i].status = ImageStatus::Good;
+    // The new contents are hashed again when decoded, until then the image is its own burst
+    c.hashed[index] = 0;
+    c.hash[index] = 0;
+    c.sharpness[index] = 0.0f;
+    c.sameAsPrevious[index] = 0;
+    if (index + 1 < c.size()) c.sameAsPrevious[index + 1] = 0;
+}
+
+// Inserts the files reported since the last call in catalogue order, and reloads the ones that
+// were rewritten in place. Needs the decode pool idle, nothing else may hold an index across the
+// shift: the packer's in-flight job is caught by the epoch. Returns the new index of every old
+// image, empty if nothing was added.
+std::vector<size_t> insertArrivals() {
+    std::vector<WatchArrival> arrivals;
+    {
+        std::lock_guard<std::mutex> lock(g_watcher.mutex);
+        arrivals.swap(g_watcher.arrived);
+    }
+    if (arrivals.empty()) return {};
+    WatchArrival newest = arrivals.back();
+    auto before = [](const WatchArrival& a, const WatchArrival& b) { return pathBefore(a.relative, a.name, b.relative, b.name); };
+    std::sort(arrivals.begin(), arrivals.end(), before);
+    arrivals.erase(std::unique(arrivals.begin(), arrivals.end(),
+                               [](const WatchArrival& a, const WatchArrival& b) { return a.relative == b.relative && a.name == b.name; }),
+                   arrivals.end());
+
+    // Where each file goes among the old images. Rewritten files keep their entry.
+    Catalogue& c = g_catalogue;
+    size_t count = c.size();
+    std::vector<size_t> positions; // Old images sorting before each added file
+    std::vector<WatchArrival> added;
+    std::vector<size_t> rewritten;
+    for (WatchArrival& arrival : arrivals) {
+        size_t lo = cataloguePosition(arrival.relative, arrival.name);
+        if (lo < count && imageRelativeDir(lo) == arrival.relative && imageName(lo) == arrival.name) {
+            rewritten.push_back(lo);
+            continue;
+        }
+        positions.push_back(lo);
+        added.push_back(std::move(arrival));
+    }
+
+    if (!rewritten.empty()) {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        for (size_t index : rewritten) discardRewritten(index);
+        // A pack of the old pixels must not land after the reset
+        g_catalogueEpoch++;
+        std::lock_guard<std::mutex> packerLock(g_packer.mutex);
+        auto stale = [&](const PendingPack& pack) { return std::binary_search(rewritten.begin(), rewritten.end(), pack.index); };
+        g_packer.pending.erase(std::remove_if(g_packer.pending.begin(), g_packer.pending.end(), stale), g_packer.pending.end());
+        for (PendingPack& pack : g_packer.pending) pack.epoch = g_catalogueEpoch;
+        std::cout << "Reloading " << rewritten.size() << (rewritten.size() == 1 ? " rewritten image." : " rewritten images.") << std::endl;
+    }
+    if (added.empty()) return {};
+
+    std::vector<size_t> oldToNew(count), newIndex(added.size());
+    for (size_t i = 0, k = 0; i <= count; ++i) {
+        while (k < added.size() && positions[k] == i) {
+            newIndex[k] = i + k;
+            k++;
+        }
+        if (i < count) oldToNew[i] = i + k;
+    }
+    size_t total = count + added.size();
+
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+    spreadOut(c.dir, oldToNew, total, 0u);
+    spreadOut(c.name, oldToNew, total, 0u);
+    spreadOut(c.nameLength, oldToNew, total, (uint16_t)0);
+    for (size_t k = 0; k < added.size(); ++k) {
+        uint32_t dir = UINT32_MAX;
+        for (uint32_t d = 0; d < c.dirs.size() && dir == UINT32_MAX; ++d) {
+            const CatalogueDir& entry = c.dirs[d];
+            if (std::string_view(c.arena).substr(entry.path + entry.pathLength - 1 - entry.relativeLength, entry.relativeLength) == added[k].relative) dir = d;
+        }
+        if (dir == UINT32_MAX) {
+            // The first image of the root when only its subdirectories had images
+            CatalogueDir entry;
+            entry.path = (uint32_t)c.arena.size();
+            c.arena += (g_rootDir / "").string();
+            if (!added[k].relative.empty()) c.arena += added[k].relative + "/";
+            entry.pathLength = (uint32_t)(c.arena.size() - entry.path);
+            entry.relativeLength = (uint32_t)added[k].relative.size();
+            dir = (uint32_t)c.dirs.size();
+            c.dirs.push_back(entry);
+        }
+        c.dir[newIndex[k]] = dir;
+        c.name[newIndex[k]] = (uint32_t)c.arena.size();
+        c.nameLength[newIndex[k]] = (uint16_t)added[k].name.size();
+        c.arena += added[k].name;
+    }
+    spreadOut(c.status, oldToNew, total, ImageStatus::Neutral);
+    spreadOut(c.orientation, oldToNew, total, (uint8_t)0);
+    spreadOut(c.loaded, oldToNew, total, (uint8_t)0);
+    spreadOut(c.loading, oldToNew, total, (uint8_t)0);
+    spreadOut(c.failed, oldToNew, total, (uint8_t)0);
+    spreadOut(c.wantFullRes, oldToNew, total, (uint8_t)0);
+    spreadOut(c.generation, oldToNew, total, 0u);
+    spreadOut(c.cacheSlot, oldToNew, total, kNoSlot);
+    spreadOut(c.hash, oldToNew, total, (uint64_t)0);
+    spreadOut(c.sharpness, oldToNew, total, 0.0f);
+    spreadOut(c.hashed, oldToNew, total, (uint8_t)0);
+    spreadOut(c.sameAsPrevious, oldToNew, total, (uint8_t)0);
+    spreadOut(c.thumbChecked, oldToNew, total, (uint8_t)0);
+    // A new image splits the burst it landed in, it joins again once hashed
+    for (size_t index : newIndex) {
+        if (index + 1 < total) c.sameAsPrevious[index + 1] = 0;
+    }
+
+    // Everything else that holds an index
+    for (RawImage& img : g_decoded) {
+        if (img.owner != SIZE_MAX) img.owner = oldToNew[img.owner];
+    }
+    for (TextureSlot& slot : g_textureSlots) {
+        if (slot.index != SIZE_MAX) slot.index = oldToNew[slot.index];
+    }
+    for (Tile& tile : g_tiles) {
+        if (tile.index != SIZE_MAX) tile.index = oldToNew[tile.index];
+    }
+    for (Atlas& atlas : g_atlases) {
+        for (AtlasCell& cell : atlas.cells) {
+            if (cell.index != SIZE_MAX) cell.index = oldToNew[cell.index];
         }
+    }
+    std::unordered_map<size_t, std::shared_ptr<const PackedImage>> packed;
+    for (auto& [index, image] : g_packed) packed.emplace(oldToNew[index], std::move(image));
+    g_packed.swap(packed);
+    g_catalogueEpoch++;
+    {
+        std::lock_guard<std::mutex> packerLock(g_packer.mutex);
+        for (PendingPack& pack : g_packer.pending) {
+            pack.index = oldToNew[pack.index];
+            pack.epoch = g_catalogueEpoch;
+        }
+    }
+
+    g_currentIndex = oldToNew[g_currentIndex];
+    g_cacheCenter = oldToNew[g_cacheCenter];
+    if (g_gridAnchor != SIZE_MAX) g_gridAnchor = oldToNew[g_gridAnchor];
+    for (size_t k = 0; k < added.size() && g_followNewest; ++k) {
+        if (added[k].relative != newest.relative || added[k].name != newest.name) continue;
+        g_currentIndex = newIndex[k];
+        g_navDirection = 1;
+        g_panX = g_panY = 0.0f;
+    }
+    setGridFirst((long long)oldToNew[std::min(g_gridFirst, count - 1)]);
+    if (g_gridMode) scrollGridToCursor();
+
+    std::cout << "Added " << added.size() << (added.size() == 1 ? " new image" : " new images") << ", " << total << " in total." << std::endl;
+    return oldToNew;
+}
+
+// ---------------------------------------------------------
+// Main Application
+// ---------------------------------------------------------
 
-        // Launch async loader
-        futures.push_back(std::async(std::launch::async, loadImageIntoMemory, std::ref(g_images[i])));
+int main(int argc, char* argv[]) {
+    // 1. Argument Parsing
+    std::string inputPathStr = ".";
+    bool recursive = false;
+    fs::path exportDir;
+    bool warmCaches = false;
+    int headlessWidth = 2560, headlessHeight = 1440;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--cache-mb" && i + 1 < argc) {
+            g_cacheBudgetBytes = (size_t)std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+        } else if (arg == "--packed-mb" && i + 1 < argc) {
+            g_packedBudgetBytes = (size_t)std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+        } else if (arg == "--filter" && i + 1 < argc) {
+            std::string filter = argv[++i];
+            g_resampleFilter = (filter == "box") ? ResampleFilter::Box : ResampleFilter::Lanczos3;
+        } else if (arg == "--trace" && i + 1 < argc) {
+            g_traceOutput = argv[++i];
+        } else if (arg == "--huge-pages") {
+            g_hugePages = true;
+        } else if (arg == "--no-pin") {
+            g_pinDecodes = false;
+        } else if (arg == "--rgba") {
+            g_planarDecodes = false;
+        } else if (arg == "--bench") {
+            g_benchMode = true;
+        } else if (arg == "--headless") {
+            g_headless = true;
+            warmCaches = true;
+        } else if (arg == "--export" && i + 1 < argc) {
+            exportDir = fs::absolute(argv[++i]);
+            g_headless = true;
+        } else if (arg == "--size" && i + 1 < argc) {
+            int width = 0, height = 0;
+            if (sscanf(argv[++i], "%dx%d", &width, &height) == 2 && width > 0 && height > 0) {
+                headlessWidth = width;
+                headlessHeight = height;
+            }
+        } else if (arg == "--recursive") {
+            recursive = true;
+        } else if (arg == "--follow") {
+            g_followNewest = true;
+        } else if (arg == "--no-preview-cache") {
+            g_usePreviewCache = false;
+        } else if (arg == "--disk-cache-mb" && i + 1 < argc) {
+            g_diskCacheBudgetBytes = (uint64_t)std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+        } else if (arg == "--no-scan-cache") {
+            g_useScanCache = false;
+        } else if (arg == "--texture-ring" && i + 1 < argc) {
+            g_textureRingRadius = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--prefetch" && i + 1 < argc) {
+            g_prefetchAhead = std::max(1, std::atoi(argv[++i]));
+            g_prefetchBehind = std::max(1, g_prefetchAhead / 4);
+        } else {
+            inputPathStr = arg;
+        }
     }
 
-    // Wait for all to finish
-    int loadedCount = 0;
-    for (auto& f : futures) {
-        f.get();
-        loadedCount++;
-        if (loadedCount % 10 == 0) std::cout << "\rProcessed " << loadedCount << "/" << count << "..." << std::flush;
+    // 2. Scan the directory and restore the review state, the batch modes stop after their work
+    if (!openCollection(inputPathStr, recursive)) return 1;
+    size_t count = g_catalogue.size();
+    if (g_headless) {
+        g_targetWidth = headlessWidth;
+        g_targetHeight = headlessHeight;
+        return runHeadless(warmCaches, exportDir);
     }
-    std::cout << std::endl;
 
-    auto endTime = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double> elapsed = endTime - startTime;
-    std::cout << "Loaded " << count << " images in " << elapsed.count() << " seconds." << std::endl;
+    std::cout << "Found " << count << " images, decoding a window of " << (g_prefetchAhead + g_prefetchBehind + 1)
+              << " within " << (g_cacheBudgetBytes / (1024 * 1024)) << " MB in the background." << std::endl;
+    auto startTime = std::chrono::high_resolution_clock::now();
 
-    // 5. Initialize SDL
+    // 3. Initialize SDL
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         std::cerr << "SDL could not initialize! Error: " << SDL_GetError() << std::endl;
         return 1;
     }
+    // Planar decodes carry JPEG's full range YCbCr
+    SDL_SetYUVConversionMode(SDL_YUV_CONVERSION_JPEG);
 
     // Create Window
     SDL_Window* window = SDL_CreateWindow(
@@ -352,152 +5551,418 @@ int main(int argc, char* argv[]) {
     SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
     if (!renderer) return 1;
 
-    // Initial Texture Upload
-    updateTexture(renderer);
+    // Decode to the size we actually draw at
+    int outW, outH;
+    SDL_GetRendererOutputSize(renderer, &outW, &outH);
+    g_targetWidth = outW;
+    g_targetHeight = outH;
+
+    g_textureSlots.resize(2 * g_textureRingRadius + 1);
+    g_wakeEvent = SDL_RegisterEvents(1);
+
+    // 4. Start decoding in the background, the first image shows up as soon as it is ready
+    startDecodePool();
+    startPacker();
+    startStatusWriter();
+    startCacheSweeper();
+    startWatcher(recursive);
+    updatePrefetchWindow();
+    bool firstImageShown = false;
+    size_t announcedIndex = SIZE_MAX; // Last image reported on stdout
+    unsigned announcedGeneration = 0;
+    size_t benchShown = 0; // Images fully shown so far in --bench mode
+    size_t benchFailed = 0; // Images skipped because they failed to decode or timed out
+    auto benchStepStart = TraceClock::now();
 
-    // 6. Main Loop
+    // 5. Main Loop
     bool quit = false;
+    bool dirty = true;
+
+    // --bench: step to the next image, or stop once every image was shown or skipped
+    auto benchAdvance = [&]() {
+        if (benchShown + benchFailed >= g_catalogue.size()) {
+            quit = true;
+            return;
+        }
+        g_currentIndex = (g_currentIndex + 1) % g_catalogue.size();
+        g_navDirection = 1;
+        countNavigation(g_currentIndex);
+        updatePrefetchWindow();
+        benchStepStart = TraceClock::now();
+        dirty = true;
+    };
     SDL_Event e;
+    setTraceThreadName("main");
+    bool showHud = false;           // Performance overlay, toggled with h
+    std::vector<double> frameTimes; // Recent frame times in ms, from waking up to presenting, for the overlay
+
+    // Only presents when the screen changed: input, a resize, new pixels for the current
+    // image, tiles or a placeholder still filling in. Otherwise it sleeps until an event.
+    bool pending = false; // Neighbour uploads left, only a short wait before the next batch
+    const TextureSlot* presentedSlot = nullptr;
+    unsigned presentedGeneration = 0;
+    int presentedLevel = 0;
+    bool presentedPreview = false;
+    auto lastNavigation = TraceClock::now();
+    SDL_Keycode navigationKey = SDLK_UNKNOWN; // Last key that stepped images, releasing it ends a scrub
 
     while (!quit) {
-        while (SDL_PollEvent(&e) != 0) {
+        int waitMs = g_scrubbing ? kScrubSettleMs : kIdleWaitMs;
+        if (g_holdDecodes) waitMs = kHoldPollMs;
+        if (pending) waitMs = std::min(waitMs, kUploadPollMs);
+        bool haveEvent = (dirty || g_benchMode) ? SDL_PollEvent(&e) != 0 : SDL_WaitEventTimeout(&e, waitMs) != 0;
+        TraceScope frameScope("frame");
+        auto frameStart = TraceClock::now();
+        bool woke = false;
+
+        for (; haveEvent; haveEvent = SDL_PollEvent(&e) != 0) {
             if (e.type == SDL_QUIT) {
                 quit = true;
+            } else if (e.type == g_wakeEvent) {
+                g_wakePosted = false;
+                woke = true;
             } else if (e.type == SDL_KEYDOWN) {
                 bool changed = false;
+                dirty = true;
+                if (g_gridMode && handleGridKey(e.key.keysym)) {
+                    updatePrefetchWindow();
+                    continue;
+                }
                 switch (e.key.keysym.sym) {
                     // Navigation
                     case SDLK_RIGHT:
                     case SDLK_d:
                     case SDLK_SPACE:
-                        g_currentIndex = (g_currentIndex + 1) % g_images.size();
+                        g_scrubbing = e.key.repeat != 0;
+                        navigationKey = e.key.keysym.sym;
+                        lastNavigation = TraceClock::now();
+                        g_currentIndex = g_groupMode ? adjacentGroup(g_currentIndex, 1) : (g_currentIndex + 1) % g_catalogue.size();
+                        g_navDirection = 1;
+                        g_panX = g_panY = 0.0f;
+                        countNavigation(g_currentIndex);
                         changed = true;
                         break;
                     case SDLK_LEFT:
                     case SDLK_a:
-                        g_currentIndex = (g_currentIndex == 0) ? g_images.size() - 1 : g_currentIndex - 1;
+                        g_scrubbing = e.key.repeat != 0;
+                        navigationKey = e.key.keysym.sym;
+                        lastNavigation = TraceClock::now();
+                        if (g_groupMode) {
+                            g_currentIndex = adjacentGroup(g_currentIndex, -1);
+                        } else {
+                            g_currentIndex = (g_currentIndex == 0) ? g_catalogue.size() - 1 : g_currentIndex - 1;
+                        }
+                        g_navDirection = -1;
+                        g_panX = g_panY = 0.0f;
+                        countNavigation(g_currentIndex);
                         changed = true;
                         break;
                     
                     // Review Controls
                     case SDLK_UP:
-                        setReviewStatus(g_images[g_currentIndex], ImageStatus::Good);
+                        setReviewStatus(g_currentIndex, ImageStatus::Good);
                         changed = true; // Redraw to show border
                         break;
                     case SDLK_DOWN:
-                        if (g_images[g_currentIndex].status == ImageStatus::Good) {
-                            setReviewStatus(g_images[g_currentIndex], ImageStatus::Neutral);
+                        if (g_catalogue.status[g_currentIndex] == ImageStatus::Good) {
+                            setReviewStatus(g_currentIndex, ImageStatus::Neutral);
                         } else {
-                            setReviewStatus(g_images[g_currentIndex], ImageStatus::Bad);
+                            setReviewStatus(g_currentIndex, ImageStatus::Bad);
                         }
                         changed = true; // Redraw to show border
                         break;
                     
                     // Rotation Controls
+                    // Only the display transform changes, the pixels and texture stay as they are
                     case SDLK_PAGEDOWN: { // Clockwise rotation (90 deg)
-                        RawImage& current = g_images[g_currentIndex];
-                        if (current.loaded && current.data) {
-                            unsigned char* rotated_data = rotateImageClockwise(current.data, current.width, current.height);
-                            if (rotated_data) {
-                                stbi_image_free(current.data);
-                                current.data = rotated_data;
-                                std::swap(current.width, current.height); // Flip dimensions
-                                changed = true;
-                                std::cout << "Rotated Clockwise: " << current.width << "x" << current.height << std::endl;
-                            }
-                        }
+                        resolveOrientation(g_currentIndex); // Before the first load has read it
+                        std::lock_guard<std::mutex> lock(g_cacheMutex);
+                        uint8_t& orientation = g_catalogue.orientation[g_currentIndex];
+                        orientation = (uint8_t)rotateOrientation(orientation, 1);
+                        journalImage(g_currentIndex, orientation);
+                        g_statusWriter.cv.notify_one();
+                        std::cout << "Rotated Clockwise: orientation " << (int)orientation << std::endl;
                         break;
                     }
                     case SDLK_PAGEUP: { // Counter-Clockwise rotation (90 deg)
-                        RawImage& current = g_images[g_currentIndex];
-                        if (current.loaded && current.data) {
-                            unsigned char* rotated_data = rotateImageCounterClockwise(current.data, current.width, current.height);
-                            if (rotated_data) {
-                                stbi_image_free(current.data);
-                                current.data = rotated_data;
-                                std::swap(current.width, current.height); // Flip dimensions
-                                changed = true;
-                                std::cout << "Rotated Counter-Clockwise: " << current.width << "x" << current.height << std::endl;
-                            }
+                        resolveOrientation(g_currentIndex); // Before the first load has read it
+                        std::lock_guard<std::mutex> lock(g_cacheMutex);
+                        uint8_t& orientation = g_catalogue.orientation[g_currentIndex];
+                        orientation = (uint8_t)rotateOrientation(orientation, -1);
+                        journalImage(g_currentIndex, orientation);
+                        g_statusWriter.cv.notify_one();
+                        std::cout << "Rotated Counter-Clockwise: orientation " << (int)orientation << std::endl;
+                        break;
+                    }
+
+                    // Toggle 1:1 zoom, decodes the image at full resolution
+                    case SDLK_z:
+                        g_zoomScale = (g_zoomScale > 0.0f) ? 0.0f : 1.0f;
+                        g_panX = g_panY = 0.0f;
+                        changed = true;
+                        std::cout << "Zoom " << (g_zoomScale > 0.0f ? "1:1" : "fit") << std::endl;
+                        break;
+
+                    // Zoom in and out around the window center
+                    case SDLK_EQUALS:
+                    case SDLK_PLUS:
+                    case SDLK_MINUS:
+                        stepZoom(e.key.keysym.sym != SDLK_MINUS, fitScale(g_currentIndex, renderer),
+                                 orientationTransform(imageOrientation(g_currentIndex)), 0.0f, 0.0f);
+                        changed = true;
+                        break;
+
+                    // Pan by a quarter of the window
+                    case SDLK_i:
+                    case SDLK_j:
+                    case SDLK_k:
+                    case SDLK_l: {
+                        int winW, winH;
+                        SDL_GetRendererOutputSize(renderer, &winW, &winH);
+                        float dx = 0.0f, dy = 0.0f;
+                        switch (e.key.keysym.sym) {
+                            case SDLK_i: dy = -winH / 4.0f; break;
+                            case SDLK_k: dy = winH / 4.0f; break;
+                            case SDLK_j: dx = -winW / 4.0f; break;
+                            default: dx = winW / 4.0f; break;
                         }
+                        panBy(dx, dy, orientationTransform(imageOrientation(g_currentIndex)));
                         break;
                     }
 
+                    // Step between bursts, showing the sharpest frame of each
+                    case SDLK_g:
+                        g_groupMode = !g_groupMode;
+                        std::cout << "Burst navigation " << (g_groupMode ? "on" : "off") << std::endl;
+                        break;
+
+                    // Contact sheet around the current image
+                    case SDLK_c:
+                        g_gridMode = true;
+                        g_scrubbing = false;
+                        scrollGridToCursor();
+                        changed = true;
+                        std::cout << "Contact sheet on" << std::endl;
+                        break;
+
+                    case SDLK_h:
+                        showHud = !showHud;
+                        break;
+
                     case SDLK_ESCAPE:
                         quit = true;
                         break;
                 }
 
                 if (changed) {
-                    updateTexture(renderer);
+                    updatePrefetchWindow();
                 }
+            } else if (e.type == SDL_MOUSEWHEEL && e.wheel.y != 0 && g_gridMode) {
+                // Scroll the sheet a row per notch
+                setGridFirst((long long)g_gridFirst - (long long)e.wheel.y * kGridColumns);
+                updatePrefetchWindow();
+                dirty = true;
+            } else if (e.type == SDL_MOUSEWHEEL && e.wheel.y != 0) {
+                // Zoom around the cursor
+                int winW, winH, mouseX, mouseY;
+                SDL_GetRendererOutputSize(renderer, &winW, &winH);
+                SDL_GetMouseState(&mouseX, &mouseY);
+                stepZoom(e.wheel.y > 0, fitScale(g_currentIndex, renderer),
+                         orientationTransform(imageOrientation(g_currentIndex)), mouseX - winW / 2.0f, mouseY - winH / 2.0f);
+                updatePrefetchWindow();
+                dirty = true;
+            } else if (e.type == SDL_MOUSEMOTION && (e.motion.state & SDL_BUTTON_LMASK) && !g_gridMode) {
+                // Drag the image along with the cursor
+                panBy(-(float)e.motion.xrel, -(float)e.motion.yrel, orientationTransform(imageOrientation(g_currentIndex)));
+                dirty = true;
+            } else if (e.type == SDL_KEYUP) {
+                // Releasing the key settles a scrub right away instead of after the timeout.
+                // Other keys, say a modifier let go mid-scrub, don't.
+                if (g_scrubbing && e.key.keysym.sym == navigationKey) lastNavigation = TraceClock::time_point();
             } else if (e.type == SDL_WINDOWEVENT) {
+                dirty = true;
                  if (e.window.event == SDL_WINDOWEVENT_RESIZED) {
-                     SDL_RenderPresent(renderer); 
+                     int outW, outH;
+                     SDL_GetRendererOutputSize(renderer, &outW, &outH);
+                     g_targetWidth = outW;
+                     g_targetHeight = outH;
                  }
             }
         }
 
+        traceRecord("events", frameStart, TraceClock::now());
+
+        // Navigation settled, decode the image the user stopped on at full quality
+        if (g_scrubbing && TraceClock::now() - lastNavigation >= std::chrono::milliseconds(kScrubSettleMs)) {
+            g_scrubbing = false;
+            updatePrefetchWindow();
+        }
+
+        // New files: hold back decodes until the pool has drained, then insert them
+        if (!g_holdDecodes && haveArrivals()) {
+            g_holdDecodes = true;
+            updatePrefetchWindow();
+        }
+        if (g_holdDecodes && decodePoolIdle()) {
+            std::vector<size_t> oldToNew = insertArrivals();
+            if (!oldToNew.empty() && announcedIndex != SIZE_MAX) announcedIndex = oldToNew[announcedIndex];
+            g_holdDecodes = false;
+            updatePrefetchWindow();
+            dirty = true;
+        }
+
+        // Pick up decodes that landed and continue the neighbour uploads
+        TextureSlot* shown = nullptr;
+        if (g_gridMode) {
+            if (updateAtlas(renderer, pending)) dirty = true;
+        } else {
+            pending = updateTextures(renderer);
+            shown = findTextureSlot(g_currentIndex);
+            if (!slotComplete(shown)) shown = nullptr;
+        }
+        if (shown != presentedSlot ||
+            (shown && (shown->generation != presentedGeneration || shown->level != presentedLevel || shown->preview != presentedPreview))) {
+            dirty = true;
+        }
+        if (woke && showHud) dirty = true; // Cache and queue figures changed
+
+        if (shown && !shown->preview && (announcedIndex != g_currentIndex || announcedGeneration != shown->generation)) {
+            announcedIndex = g_currentIndex;
+            announcedGeneration = shown->generation;
+            std::cout << "[" << (g_currentIndex + 1) << "/" << g_catalogue.size() << "] Viewing: " << linkName(g_currentIndex)
+                      << " (" << shown->width << "x" << shown->height << " of " << shown->fullWidth << "x" << shown->fullHeight << ")";
+            if (g_groupMode) std::cout << " sharpest of a burst of " << groupSize(g_currentIndex);
+            std::cout << std::endl;
+        }
+        if (!firstImageShown && shown) {
+            firstImageShown = true;
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+            std::cout << "First image shown after " << elapsed.count() << " seconds." << std::endl;
+        }
+        if (g_benchMode && !(shown && !shown->preview) &&
+            (isImageFailed(g_currentIndex) || TraceClock::now() - benchStepStart > kBenchStepTimeout)) {
+            benchFailed++;
+            benchAdvance();
+        }
+        if (!dirty) continue;
+        dirty = false;
+
         // ------------------
         // Rendering
         // ------------------
+        auto renderStart = TraceClock::now();
         SDL_SetRenderDrawColor(renderer, 20, 20, 20, 255); // Dark Grey Background
         SDL_RenderClear(renderer);
 
-        if (g_displayTexture) {
-            // Get Window Size
-            int winW, winH;
-            SDL_GetRendererOutputSize(renderer, &winW, &winH);
-
-            // Calculate Aspect Ratio Fit
-            float imgAspect = (float)g_texWidth / (float)g_texHeight;
-            float winAspect = (float)winW / (float)winH;
-
-            SDL_Rect dstRect;
-            
-            if (winAspect > imgAspect) {
-                dstRect.h = winH;
-                dstRect.w = (int)(winH * imgAspect);
-                dstRect.y = 0;
-                dstRect.x = (winW - dstRect.w) / 2;
+        // Get Window Size
+        int winW, winH;
+        SDL_GetRendererOutputSize(renderer, &winW, &winH);
+
+        SDL_Rect dstRect;
+        if (g_gridMode) {
+            drawGrid(renderer, winW, winH);
+        } else if (shown) {
+            // Quarter turns swap the on-screen dimensions
+            DisplayTransform transform = orientationTransform(imageOrientation(g_currentIndex));
+            bool sideways = transform.quarterTurns % 2;
+            int shownW = sideways ? shown->fullHeight : shown->fullWidth;
+            int shownH = sideways ? shown->fullWidth : shown->fullHeight;
+            if (g_zoomScale > 0.0f) {
+                // Fixed screen pixels per source pixel, around the panned view center
+                clampPan(shown->fullWidth, shown->fullHeight, transform, winW, winH);
+                float offsetX = -g_panX * g_zoomScale, offsetY = -g_panY * g_zoomScale;
+                toScreen(transform, offsetX, offsetY);
+                shownW = (int)(shownW * g_zoomScale);
+                shownH = (int)(shownH * g_zoomScale);
+                dstRect = { (int)(winW / 2.0f + offsetX) - shownW / 2, (int)(winH / 2.0f + offsetY) - shownH / 2, shownW, shownH };
             } else {
-                dstRect.w = winW;
-                dstRect.h = (int)(winW / imgAspect);
-                dstRect.x = 0;
-                dstRect.y = (winH - dstRect.h) / 2;
-            }
-
-            SDL_RenderCopy(renderer, g_displayTexture, nullptr, &dstRect);
-            
-            // Draw Status Border
-            RawImage& current = g_images[g_currentIndex];
-            if (current.status == ImageStatus::Good) {
-                SDL_SetRenderDrawColor(renderer, 50, 205, 50, 255); // Lime Green
-                // Draw a thick border (5px)
-                SDL_Rect border = dstRect;
-                for(int i=0; i<5; ++i) {
-                    SDL_RenderDrawRect(renderer, &border);
-                    border.x++; border.y++; border.w -= 2; border.h -= 2;
-                }
-            } else if (current.status == ImageStatus::Bad) {
-                SDL_SetRenderDrawColor(renderer, 220, 20, 60, 255); // Crimson Red
-                SDL_Rect border = dstRect;
-                for(int i=0; i<5; ++i) {
-                    SDL_RenderDrawRect(renderer, &border);
-                    border.x++; border.y++; border.w -= 2; border.h -= 2;
-                }
+                dstRect = fitToWindow(shownW, shownH, winW, winH);
+            }
+
+            // SDL rotates around the center of the unrotated rect, so swap it back for sideways images
+            SDL_Rect copyRect = dstRect;
+            if (sideways) {
+                copyRect.w = dstRect.h;
+                copyRect.h = dstRect.w;
+                copyRect.x = dstRect.x + (dstRect.w - copyRect.w) / 2;
+                copyRect.y = dstRect.y + (dstRect.h - copyRect.h) / 2;
+            }
+            SDL_RenderCopyEx(renderer, shown->texture, nullptr, &copyRect, transform.quarterTurns * 90.0, nullptr,
+                             transform.mirror ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE);
+
+            // Sharper tiles over the stretched texture once the full resolution decode is in,
+            // drawn again next iteration until all visible ones are uploaded
+            if (g_zoomScale > 0.0f && drawTiles(renderer, g_currentIndex, transform, winW, winH)) dirty = true;
+        } else {
+            // Not decoded yet, assume a 3:2 frame until the real size is known
+            dstRect = fitToWindow(3, 2, winW, winH);
+            bool failed = isImageFailed(g_currentIndex);
+            drawPlaceholder(renderer, dstRect, failed);
+            if (!failed) dirty = true; // Keep the progress bar moving
+        }
+
+        // Draw Status Border
+        ImageStatus status = g_gridMode ? ImageStatus::Neutral : g_catalogue.status[g_currentIndex];
+        if (status == ImageStatus::Good) {
+            SDL_SetRenderDrawColor(renderer, 50, 205, 50, 255); // Lime Green
+            drawStatusBorder(renderer, dstRect);
+        } else if (status == ImageStatus::Bad) {
+            SDL_SetRenderDrawColor(renderer, 220, 20, 60, 255); // Crimson Red
+            drawStatusBorder(renderer, dstRect);
+        }
+
+        if (showHud) {
+            double total = 0.0, worst = 0.0;
+            for (double t : frameTimes) {
+                total += t;
+                worst = std::max(worst, t);
             }
+            drawHud(renderer, hudLines(frameTimes.empty() ? 0.0 : total / frameTimes.size(), worst));
         }
+        traceRecord("render", renderStart, TraceClock::now());
 
+        auto presentStart = TraceClock::now();
         SDL_RenderPresent(renderer);
+        traceRecord("SDL_RenderPresent", presentStart, TraceClock::now());
+        presentedSlot = shown;
+        presentedGeneration = shown ? shown->generation : 0;
+        presentedLevel = shown ? shown->level : 0;
+        presentedPreview = shown && shown->preview;
+        frameTimes.push_back(std::chrono::duration<double, std::milli>(TraceClock::now() - frameStart).count());
+        if (frameTimes.size() > 120) frameTimes.erase(frameTimes.begin());
+
+        // --bench: move on as soon as the decoded image is on screen
+        if (g_benchMode && shown && !shown->preview) {
+            recordStage(BenchStage::Present, benchStepStart);
+            benchShown++;
+            benchAdvance();
+        }
     }
 
-    // 7. Cleanup
-    for (auto& img : g_images) {
-        if (img.data) stbi_image_free(img.data);
+    if (g_benchMode) {
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+        printBenchReport(elapsed.count(), benchShown, benchFailed);
     }
 
-    if (g_displayTexture) SDL_DestroyTexture(g_displayTexture);
+    // 6. Cleanup
+    stopWatcher();
+    stopDecodePool();
+    stopPacker();
+    stopStatusWriter();
+    stopCacheSweeper();
+    if (!g_traceOutput.empty()) writeTrace(g_traceOutput);
+    g_decoded.clear();
+    g_packed.clear();
+
+    for (auto& slot : g_textureSlots) {
+        if (slot.texture) SDL_DestroyTexture(slot.texture);
+    }
+    for (auto& tile : g_tiles) {
+        SDL_DestroyTexture(tile.texture);
+    }
+    for (auto& atlas : g_atlases) {
+        SDL_DestroyTexture(atlas.texture);
+    }
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();